@@ -3,38 +3,91 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdbool.h>
+#include <errno.h>
+#include <stddef.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
 
 #define BLOCK_SIZE 512
-#define NUM_BLOCKS 1024
-#define MAX_NAME 50
-#define LINE_BUF 7000
-
-typedef struct FreeBlock {
-    int index;
-    struct FreeBlock *next;
-    struct FreeBlock *prev;
-} FreeBlock;
+#define INITIAL_BLOCKS 1024
+#define MAX_BLOCKS (1 << 30)
+#define MAX_NAME 255
+#define IMPORT_CHUNK (64 * 1024)
+
+#define NODE_POOL_CHUNK 4096
+#define NAME_ARENA_CHUNK (64 * 1024)
+#define NAME_TABLE_INIT 1024
+
+// Cold part of a file: block map and size. Directories have none.
+typedef struct FileData {
+    long long size;
+    int blockCount;
+    int blockCap;
+    int *blockPointers;
+} FileData;
 
+// Hot part walked by lookups and traversals. The name points into the
+// interned name arena, so equal names share one pointer.
 typedef struct FileNode {
-    char name[MAX_NAME + 1];// +1 for string terminator '\0'
-    bool isDirectory;
+    const char *name;
     struct FileNode *parent;
     struct FileNode *child;
     struct FileNode *next;
     struct FileNode *prev;
-
-    int *blockPointers; 
-    int blockCount;
-    int blockCap;
-    int size;
+    FileData *data;
 } FileNode;
 
+typedef struct PoolChunk {
+    struct PoolChunk *next;
+} PoolChunk;
+
+// Fixed-size object pool: objects are carved from large chunks and
+// recycled through an intrusive free list.
+typedef struct ObjectPool {
+    size_t objSize;
+    size_t perChunk;
+    PoolChunk *chunks;
+    unsigned char *cursor;
+    size_t cursorLeft;
+    void *freeList;
+    size_t live;
+    size_t chunkCount;
+} ObjectPool;
+
+typedef struct ArenaChunk {
+    struct ArenaChunk *next;
+    size_t size;
+} ArenaChunk;
+
+typedef struct NameArena {
+    ArenaChunk *chunks;
+    char *cursor;
+    size_t left;
+    const char **slots;
+    unsigned int *hashes;
+    unsigned int *refs;
+    size_t cap;
+    size_t count;
+    size_t bytes;
+    size_t deadBytes;
+} NameArena;
+
 typedef struct FileSystem {
-    unsigned char virtualDisk[NUM_BLOCKS][BLOCK_SIZE];
-    FreeBlock *freeHead;
-    FreeBlock *freeTail;
+    unsigned char (*virtualDisk)[BLOCK_SIZE];
+    int numBlocks;
+
+    // Free block indices as a FIFO ring sized to numBlocks: allocation
+    // takes from the head and freed blocks go to the tail.
+    int *freeRing;
+    int freeHeadPos;
     int freeCount;
 
+    ObjectPool nodePool;
+    ObjectPool dataPool;
+    NameArena names;
+
     FileNode *root;
     FileNode *cwd;
 } FileSystem;
@@ -42,43 +95,310 @@ typedef struct FileSystem {
 static FileSystem file;
 
 
-static void safe_name_copy(char *dst, const char *src) {
-    if (!dst) return;
-    if (!src) { dst[0] = '\0'; return; }
-    strncpy(dst, src, MAX_NAME);
-    dst[MAX_NAME] = '\0';
+static void poolInit(ObjectPool *pool, size_t objSize, size_t perChunk) {
+    if (objSize < sizeof(void*)) objSize = sizeof(void*);
+    pool->objSize = (objSize + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+    pool->perChunk = perChunk;
+    pool->chunks = NULL;
+    pool->cursor = NULL;
+    pool->cursorLeft = 0;
+    pool->freeList = NULL;
+    pool->live = 0;
+    pool->chunkCount = 0;
 }
 
-static void addFreeBlockTail(int idx) {
-    FreeBlock *node = (FreeBlock*)malloc(sizeof(FreeBlock));
-    if (!node) {
-        fprintf(stderr, "malloc failed in addFreeBlockTail\n");
+static void* poolAlloc(ObjectPool *pool) {
+    void *obj;
+    if (pool->freeList) {
+        obj = pool->freeList;
+        pool->freeList = *(void**)obj;
+    } else {
+        if (pool->cursorLeft == 0) {
+            PoolChunk *c = (PoolChunk*)malloc(sizeof(PoolChunk) + pool->objSize * pool->perChunk);
+            if (!c) {
+                fprintf(stderr, "malloc failed in poolAlloc\n");
+                exit(EXIT_FAILURE);
+            }
+            c->next = pool->chunks;
+            pool->chunks = c;
+            pool->chunkCount++;
+            pool->cursor = (unsigned char*)(c + 1);
+            pool->cursorLeft = pool->perChunk;
+        }
+        obj = pool->cursor;
+        pool->cursor += pool->objSize;
+        pool->cursorLeft--;
+    }
+    pool->live++;
+    return obj;
+}
+
+static void poolFree(ObjectPool *pool, void *obj) {
+    if (!obj) return;
+    *(void**)obj = pool->freeList;
+    pool->freeList = obj;
+    pool->live--;
+}
+
+// Visits every slot ever handed out, including ones now on the free list.
+static void poolForEach(ObjectPool *pool, void (*fn)(void *obj)) {
+    for (PoolChunk *c = pool->chunks; c; c = c->next) {
+        size_t used = (c == pool->chunks) ? pool->perChunk - pool->cursorLeft : pool->perChunk;
+        unsigned char *p = (unsigned char*)(c + 1);
+        for (size_t i = 0; i < used; ++i) fn(p + i * pool->objSize);
+    }
+}
+
+static void poolDestroy(ObjectPool *pool) {
+    PoolChunk *c = pool->chunks;
+    while (c) {
+        PoolChunk *n = c->next;
+        free(c);
+        c = n;
+    }
+    poolInit(pool, pool->objSize, pool->perChunk);
+}
+
+
+static unsigned int hashName(const char *s) {
+    unsigned int h = 2166136261u;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void nameTableAlloc(NameArena *a, size_t cap) {
+    a->slots = (const char**)calloc(cap, sizeof(const char*));
+    a->hashes = (unsigned int*)calloc(cap, sizeof(unsigned int));
+    a->refs = (unsigned int*)calloc(cap, sizeof(unsigned int));
+    if (!a->slots || !a->hashes || !a->refs) {
+        fprintf(stderr, "calloc failed in nameTableAlloc\n");
         exit(EXIT_FAILURE);
     }
-    node->index = idx;
-    node->next = NULL;
-    node->prev = file.freeTail;
-    if (!file.freeHead) file.freeHead = node;
-    else file.freeTail->next = node;
-    file.freeTail = node;
+    a->cap = cap;
+}
+
+static void nameArenaInit(NameArena *a) {
+    a->chunks = NULL;
+    a->cursor = NULL;
+    a->left = 0;
+    a->count = 0;
+    a->bytes = 0;
+    a->deadBytes = 0;
+    nameTableAlloc(a, NAME_TABLE_INIT);
+}
+
+static size_t nameSlot(const NameArena *a, const char *s, unsigned int h) {
+    size_t mask = a->cap - 1;
+    size_t i = h & mask;
+    while (a->slots[i]) {
+        if (a->hashes[i] == h && strcmp(a->slots[i], s) == 0) break;
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+static void nameTableGrow(NameArena *a) {
+    const char **oldSlots = a->slots;
+    unsigned int *oldHashes = a->hashes;
+    unsigned int *oldRefs = a->refs;
+    size_t oldCap = a->cap;
+    nameTableAlloc(a, oldCap * 2);
+    for (size_t i = 0; i < oldCap; ++i) {
+        if (!oldSlots[i]) continue;
+        size_t j = nameSlot(a, oldSlots[i], oldHashes[i]);
+        a->slots[j] = oldSlots[i];
+        a->hashes[j] = oldHashes[i];
+        a->refs[j] = oldRefs[i];
+    }
+    free(oldSlots);
+    free(oldHashes);
+    free(oldRefs);
+}
+
+static char* nameArenaCopy(NameArena *a, const char *s, size_t len) {
+    if (a->left < len + 1) {
+        size_t size = NAME_ARENA_CHUNK;
+        if (size < len + 1) size = len + 1;
+        ArenaChunk *c = (ArenaChunk*)malloc(sizeof(ArenaChunk) + size);
+        if (!c) {
+            fprintf(stderr, "malloc failed in nameArenaCopy\n");
+            exit(EXIT_FAILURE);
+        }
+        c->next = a->chunks;
+        c->size = size;
+        a->chunks = c;
+        a->cursor = (char*)(c + 1);
+        a->left = size;
+    }
+    char *dst = a->cursor;
+    memcpy(dst, s, len + 1);
+    a->cursor += len + 1;
+    a->left -= len + 1;
+    a->bytes += len + 1;
+    return dst;
+}
+
+// Returns the interned copy of s, or NULL if no node was ever given that name.
+static const char* lookupName(const char *s) {
+    NameArena *a = &file.names;
+    return a->slots[nameSlot(a, s, hashName(s))];
+}
+
+static const char* internName(const char *s) {
+    NameArena *a = &file.names;
+    unsigned int h = hashName(s);
+    size_t i = nameSlot(a, s, h);
+    if (a->slots[i]) {
+        a->refs[i]++;
+        return a->slots[i];
+    }
+    if ((a->count + 1) * 4 > a->cap * 3) {
+        nameTableGrow(a);
+        i = nameSlot(a, s, h);
+    }
+    a->slots[i] = nameArenaCopy(a, s, strlen(s));
+    a->hashes[i] = h;
+    a->refs[i] = 1;
+    a->count++;
+    return a->slots[i];
+}
+
+// Empties slot i and shifts later members of its probe run back so
+// linear probing still finds them.
+static void nameSlotRemove(NameArena *a, size_t i) {
+    size_t mask = a->cap - 1;
+    size_t j = i;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (!a->slots[j]) break;
+        size_t home = a->hashes[j] & mask;
+        if (((j - home) & mask) < ((j - i) & mask)) continue;
+        a->slots[i] = a->slots[j];
+        a->hashes[i] = a->hashes[j];
+        a->refs[i] = a->refs[j];
+        i = j;
+    }
+    a->slots[i] = NULL;
+    a->hashes[i] = 0;
+    a->refs[i] = 0;
+}
+
+// Preorder successor using the parent/child/sibling links, so whole-tree
+// passes need no recursion or explicit stack.
+static FileNode* nextPreorder(FileNode *n) {
+    if (n->child) return n->child;
+    while (n != file.root) {
+        FileNode *p = n->parent;
+        if (n->next != p->child) return n->next;
+        n = p;
+    }
+    return NULL;
+}
+
+// Copies the live names into a fresh arena and repoints every node at
+// them, then drops the old chunks that were mostly dead names.
+static void compactNames() {
+    NameArena old = file.names;
+    nameArenaInit(&file.names);
+    for (FileNode *n = file.root; n; n = nextPreorder(n)) n->name = internName(n->name);
+    free(old.slots);
+    free(old.hashes);
+    free(old.refs);
+    ArenaChunk *c = old.chunks;
+    while (c) {
+        ArenaChunk *next = c->next;
+        free(c);
+        c = next;
+    }
+}
+
+// Drops one reference to an interned name. Bytes of names nobody uses
+// stay in the arena until they outweigh the live ones, then it is rebuilt.
+static void releaseName(const char *s) {
+    NameArena *a = &file.names;
+    size_t i = nameSlot(a, s, hashName(s));
+    if (!a->slots[i] || --a->refs[i] > 0) return;
+    a->deadBytes += strlen(s) + 1;
+    a->count--;
+    nameSlotRemove(a, i);
+    if (a->deadBytes > NAME_ARENA_CHUNK && a->deadBytes * 2 > a->bytes) compactNames();
+}
+
+static void nameArenaDestroy(NameArena *a) {
+    ArenaChunk *c = a->chunks;
+    while (c) {
+        ArenaChunk *n = c->next;
+        free(c);
+        c = n;
+    }
+    free(a->slots);
+    free(a->hashes);
+    free(a->refs);
+    a->slots = NULL;
+    a->hashes = NULL;
+    a->refs = NULL;
+    a->chunks = NULL;
+    a->cap = a->count = a->left = a->bytes = a->deadBytes = 0;
+}
+
+
+static inline bool isDirectoryNode(const FileNode *n) {
+    return n->data == NULL;
+}
+
+static void addFreeBlockTail(int idx) {
+    file.freeRing[(file.freeHeadPos + file.freeCount) % file.numBlocks] = idx;
     file.freeCount++;
 }
 
+// Grows the block pool to at least minBlocks, doubling to amortize the
+// copy. New blocks are appended to the free ring in ascending order.
+static bool growDisk(int minBlocks) {
+    if (minBlocks <= file.numBlocks) return true;
+    if (minBlocks > MAX_BLOCKS) return false;
+    long long target = file.numBlocks ? file.numBlocks : INITIAL_BLOCKS;
+    while (target < minBlocks) target *= 2;
+    if (target > MAX_BLOCKS) target = MAX_BLOCKS;
+
+    unsigned char (*disk)[BLOCK_SIZE] = realloc(file.virtualDisk, (size_t)target * BLOCK_SIZE);
+    if (!disk) return false;
+    file.virtualDisk = disk;
+    int *ring = (int*)malloc(sizeof(int) * (size_t)target);
+    if (!ring) return false;
+    for (int i = 0; i < file.freeCount; ++i) {
+        ring[i] = file.freeRing[(file.freeHeadPos + i) % file.numBlocks];
+    }
+    free(file.freeRing);
+    file.freeRing = ring;
+    file.freeHeadPos = 0;
+
+    int oldCount = file.numBlocks;
+    file.numBlocks = (int)target;
+    for (int i = oldCount; i < file.numBlocks; ++i) addFreeBlockTail(i);
+    return true;
+}
+
+static bool ensureFreeBlocks(long long need) {
+    if (need <= file.freeCount) return true;
+    long long total = (long long)file.numBlocks - file.freeCount + need;
+    if (total > MAX_BLOCKS) return false;
+    return growDisk((int)total);
+}
+
 int allocateBlockIndex() {
-    if (!file.freeHead) return -1;
-    FreeBlock *b = file.freeHead;
-    int idx = b->index;
-    file.freeHead = b->next;
-    if (file.freeHead) file.freeHead->prev = NULL;
-    else file.freeTail = NULL;
-    free(b);
+    if (file.freeCount == 0 && !growDisk(file.numBlocks + 1)) return -1;
+    int idx = file.freeRing[file.freeHeadPos];
+    file.freeHeadPos = (file.freeHeadPos + 1) % file.numBlocks;
     file.freeCount--;
     memset(file.virtualDisk[idx], 0, BLOCK_SIZE);
     return idx;
 }
 
 void freeBlockIndex(int index) {
-    if (index < 0 || index >= NUM_BLOCKS) return;
+    if (index < 0 || index >= file.numBlocks) return;
     addFreeBlockTail(index);
 }
 
@@ -87,47 +407,49 @@ int countFreeBlocks() {
 }
 
 
-static void ensureBlockCapacity(FileNode *n, int need) {
-    if (!n) return;
-    if (n->blockCap >= need) return;
-    int cap = (n->blockCap == 0) ? 4 : n->blockCap;
+static void ensureBlockCapacity(FileData *d, int need) {
+    if (!d) return;
+    if (d->blockCap >= need) return;
+    int cap = (d->blockCap == 0) ? 4 : d->blockCap;
     while (cap < need) cap *= 2;
-    int *tmp = (int*)realloc(n->blockPointers, sizeof(int) * cap);
+    int *tmp = (int*)realloc(d->blockPointers, sizeof(int) * cap);
     if (!tmp) {
         fprintf(stderr, "realloc failed\n");
         exit(EXIT_FAILURE);
     }
-    n->blockPointers = tmp;
-    
-    for (int i = n->blockCap; i < cap; ++i) n->blockPointers[i] = -1;
-    n->blockCap = cap;
+    d->blockPointers = tmp;
+
+    for (int i = d->blockCap; i < cap; ++i) d->blockPointers[i] = -1;
+    d->blockCap = cap;
 }
 
 FileNode* createNode(const char *name, int isDir) {
-    FileNode *n = (FileNode*)malloc(sizeof(FileNode));
-    if (!n) {
-        fprintf(stderr, "malloc failed in createNode\n");
-        return NULL;
-    }
-    safe_name_copy(n->name, name ? name : "");
-    n->isDirectory = (isDir ? true : false);
+    FileNode *n = (FileNode*)poolAlloc(&file.nodePool);
+    n->name = internName(name ? name : "");
     n->parent = NULL;
     n->child = NULL;
     n->next = n->prev = n;
-    n->blockPointers = NULL;
-    n->blockCount = 0;
-    n->blockCap = 0;
-    n->size = 0;
+    n->data = NULL;
+    if (!isDir) {
+        FileData *d = (FileData*)poolAlloc(&file.dataPool);
+        d->size = 0;
+        d->blockCount = 0;
+        d->blockCap = 0;
+        d->blockPointers = NULL;
+        n->data = d;
+    }
     return n;
 }
 
 
 static FileNode* findChild(FileNode *dir, const char *name) {
     if (!dir || !dir->child || !name) return NULL;
+    const char *key = lookupName(name);
+    if (!key) return NULL;
     FileNode *start = dir->child;
     FileNode *t = start;
     do {
-        if (strcmp(t->name, name) == 0) return t;
+        if (t->name == key) return t;
         t = t->next;
     } while (t != start);
     return NULL;
@@ -156,123 +478,94 @@ void removeChildFromParent(FileNode *node) {
     FileNode *parent = node->parent;
     if (!parent->child) return;
 
-    FileNode *start = parent->child;
-
-    
-    if (start == node && node->next == node) {
+    if (node->next == node) {
         parent->child = NULL;
-        node->next = node->prev = node;
-        node->parent = NULL;
-        return;
+    } else {
+        node->prev->next = node->next;
+        node->next->prev = node->prev;
+        if (parent->child == node) parent->child = node->next;
     }
-
-    FileNode *t = start;
-    do {
-        if (t == node) {
-            t->prev->next = t->next;
-            t->next->prev = t->prev;
-            if (parent->child == node) parent->child = node->next;
-            node->next = node->prev = node;
-            node->parent = NULL;
-            return;
-        }
-        t = t->next;
-    } while (t != start);
+    node->next = node->prev = node;
+    node->parent = NULL;
 }
 
 void freeFileBlocks(FileNode *f) {
-    if (!f || f->isDirectory) return;
-    for (int i = 0; i < f->blockCount; ++i) {
-        int idx = f->blockPointers[i];
-        if (idx >= 0 && idx < NUM_BLOCKS) {
+    if (!f || isDirectoryNode(f)) return;
+    FileData *d = f->data;
+    for (int i = 0; i < d->blockCount; ++i) {
+        int idx = d->blockPointers[i];
+        if (idx >= 0 && idx < file.numBlocks) {
             memset(file.virtualDisk[idx], 0, BLOCK_SIZE);
             freeBlockIndex(idx);
         }
-        f->blockPointers[i] = -1;
+        d->blockPointers[i] = -1;
     }
-    f->blockCount = 0;
-    f->size = 0;
+    d->blockCount = 0;
+    d->size = 0;
 }
 
 void destroyNode(FileNode *node) {
     if (!node) return;
-    if (!node->isDirectory) {
+    if (!isDirectoryNode(node)) {
         freeFileBlocks(node);
-        free(node->blockPointers);
-    } 
-    free(node);
-}
-
-static void freeDirectoryTree(FileNode *node) {
-    if (!node) return;
-    FileNode *child = node->child;
-    if (child) {
-        FileNode *t = child;
-        do {
-            FileNode *next = t->next;
-            freeDirectoryTree(t);
-            t = next;
-        } while (t != child);
-    }
-    if (!node->isDirectory) {
-        for (int i = 0; i < node->blockCount; ++i) {
-            int idx = node->blockPointers[i];
-            if (idx >= 0 && idx < NUM_BLOCKS) {
-                memset(file.virtualDisk[idx], 0, BLOCK_SIZE);
-                freeBlockIndex(idx);
-            }
-        }
-        free(node->blockPointers);
+        free(node->data->blockPointers);
+        node->data->blockPointers = NULL;
+        poolFree(&file.dataPool, node->data);
     }
-    free(node);
+    releaseName(node->name);
+    poolFree(&file.nodePool, node);
 }
 
 
 void initFS() {
-    file.freeHead = file.freeTail = NULL;
+    file.virtualDisk = NULL;
+    file.numBlocks = 0;
+    file.freeRing = NULL;
+    file.freeHeadPos = 0;
     file.freeCount = 0;
-    for (int i = 0; i < NUM_BLOCKS; ++i) addFreeBlockTail(i);
-
-    file.root = createNode("/", 1);
-    if (!file.root) {
-        fprintf(stderr, "Failed to allocate root\n");
+    if (!growDisk(INITIAL_BLOCKS)) {
+        fprintf(stderr, "Failed to allocate virtual disk\n");
         exit(EXIT_FAILURE);
     }
+
+    poolInit(&file.nodePool, sizeof(FileNode), NODE_POOL_CHUNK);
+    poolInit(&file.dataPool, sizeof(FileData), NODE_POOL_CHUNK);
+    nameArenaInit(&file.names);
+
+    file.root = createNode("/", 1);
     file.root->parent = NULL;
     file.root->child = NULL;
     file.root->next = file.root->prev = file.root;
     file.cwd = file.root;
+}
+
+// Freed FileData slots have blockPointers cleared by destroyNode, so a
+// linear sweep over the pool releases every live block map. The pool's
+// free-list link must not overlap that field.
+static_assert(offsetof(FileData, blockPointers) >= sizeof(void*),
+              "pool free-list link would clobber FileData.blockPointers");
 
-    for (int i = 0; i < NUM_BLOCKS; ++i) memset(file.virtualDisk[i], 0, BLOCK_SIZE);
+static void releaseBlockMap(void *obj) {
+    FileData *d = (FileData*)obj;
+    free(d->blockPointers);
+    d->blockPointers = NULL;
 }
 
 static void cleanupFS() {
-    FreeBlock *fb = file.freeHead;
-    while (fb) {
-        FreeBlock *n = fb->next;
-        free(fb);
-        fb = n;
-    }
-    file.freeHead = file.freeTail = NULL;
+    free(file.freeRing);
+    free(file.virtualDisk);
+    file.freeRing = NULL;
+    file.virtualDisk = NULL;
+    file.numBlocks = 0;
+    file.freeHeadPos = 0;
     file.freeCount = 0;
 
-    
-    if (file.root) {
-        FileNode *child = file.root->child;
-        if (child) {
-            FileNode *t = child;
-            do {
-                FileNode *next = t->next;
-                freeDirectoryTree(t);
-                t = next;
-            } while (t != child);
-        }
-        
-        free(file.root->blockPointers);
-        free(file.root);
-        file.root = NULL;
-        file.cwd = NULL;
-    }
+    poolForEach(&file.dataPool, releaseBlockMap);
+    poolDestroy(&file.dataPool);
+    poolDestroy(&file.nodePool);
+    nameArenaDestroy(&file.names);
+    file.root = NULL;
+    file.cwd = NULL;
 }
 
 
@@ -302,7 +595,7 @@ void cmd_ls() {
     FileNode *start = file.cwd->child;
     FileNode *t = start;
     do {
-        printf("%s%s\n", t->name, t->isDirectory ? "/" : "");
+        printf("%s%s\n", t->name, isDirectoryNode(t) ? "/" : "");
         t = t->next;
     } while (t != start);
 }
@@ -325,7 +618,7 @@ void cmd_cd(const char *name) {
     return;
     }
     FileNode *target = findChild(file.cwd, name);
-    if (!target || !target->isDirectory) {
+    if (!target || !isDirectoryNode(target)) {
         printf("Directory not found.\n");
         return;
     }
@@ -344,89 +637,210 @@ void cmd_pwd() {
     printPathRecursive(file.cwd);
     printf("\n");
 }
+// Appends len bytes to the file, filling its partial last block first and
+// growing the disk when the free ring runs short. Returns -2 if the file
+// would exceed MAX_BLOCKS and -1 if the disk cannot grow; nothing is
+// written in either case.
+static int appendBytes(FileData *d, const char *buf, size_t len) {
+    if (len == 0) return 0;
+    int offset = (int)(d->size % BLOCK_SIZE);
+    size_t tailRoom = (d->blockCount > 0 && offset > 0) ? (size_t)(BLOCK_SIZE - offset) : 0;
+    long long newBlocks = (len > tailRoom) ? (long long)((len - tailRoom + BLOCK_SIZE - 1) / BLOCK_SIZE) : 0;
+    if (d->blockCount + newBlocks > MAX_BLOCKS) return -2;
+    if (!ensureFreeBlocks(newBlocks)) return -1;
+    ensureBlockCapacity(d, d->blockCount + (int)newBlocks);
+
+    size_t done = 0;
+    if (tailRoom > 0) {
+        size_t n = (len < tailRoom) ? len : tailRoom;
+        memcpy(file.virtualDisk[d->blockPointers[d->blockCount - 1]] + offset, buf, n);
+        done = n;
+    }
+    while (done < len) {
+        int idx = allocateBlockIndex();
+        size_t n = len - done;
+        if (n > BLOCK_SIZE) n = BLOCK_SIZE;
+        memcpy(file.virtualDisk[idx], buf + done, n);
+        d->blockPointers[d->blockCount++] = idx;
+        done += n;
+    }
+    d->size += (long long)len;
+    return 0;
+}
+
 void cmd_write(const char *filename, const char *content) {
     if (!filename || filename[0] == '\0') { printf("write: missing filename\n"); return; }
     FileNode *fnode = findChild(file.cwd, filename);
-    if (!fnode || fnode->isDirectory) { printf("File not found.\n"); return; }
+    if (!fnode || isDirectoryNode(fnode)) { printf("File not found.\n"); return; }
 
     freeFileBlocks(fnode);
 
     size_t contentLen = content ? strlen(content) : 0;
-    size_t totalBytes = contentLen; 
-    int neededBlocks = (int)((totalBytes + BLOCK_SIZE - 1) / BLOCK_SIZE);
-    if (totalBytes == 0) neededBlocks = 0;
-
-    if (neededBlocks > NUM_BLOCKS) {
+    int rc = appendBytes(fnode->data, content, contentLen);
+    if (rc == -2) {
         printf("File too large for single file limit.\n");
         return;
     }
-    if (neededBlocks > countFreeBlocks()) {
+    if (rc < 0) {
         printf("Disk full. Not enough free blocks.\n");
         return;
     }
+    printf("Data written successfully (size=%zu bytes).\n", contentLen);
+}
 
-    
-    ensureBlockCapacity(fnode, neededBlocks);
-
-    int written = 0;
-    for (int b = 0; b < neededBlocks; ++b) {
-        int idx = allocateBlockIndex();
-        if (idx < 0) {
-            printf("Unexpected: no free block.\n");
-            
-            for (int i = 0; i < fnode->blockCount; ++i) {
-                int bi = fnode->blockPointers[i];
-                if (bi >= 0 && bi < NUM_BLOCKS) {
-                    memset(file.virtualDisk[bi], 0, BLOCK_SIZE);
-                    freeBlockIndex(bi);
-                }
-            }
-            fnode->blockCount = 0;
-            fnode->size = 0;
-            return;
+#define IOV_BATCH 64
+
+// Hands the file's blocks straight to fd with writev, one iovec per run of
+// adjacent blocks, so the bytes are never copied through a stdio buffer.
+static int writeFileToFd(const FileData *d, int fd) {
+    struct iovec iov[IOV_BATCH];
+    long long remaining = d->size;
+    int i = 0;
+    while (remaining > 0 && i < d->blockCount) {
+        int n = 0;
+        while (n < IOV_BATCH && remaining > 0 && i < d->blockCount) {
+            int start = d->blockPointers[i];
+            int run = 1;
+            while (i + run < d->blockCount && d->blockPointers[i + run] == start + run) run++;
+            long long len = (long long)run * BLOCK_SIZE;
+            if (len > remaining) len = remaining;
+            iov[n].iov_base = file.virtualDisk[start];
+            iov[n].iov_len = (size_t)len;
+            n++;
+            remaining -= len;
+            i += run;
         }
-        fnode->blockPointers[fnode->blockCount++] = idx;
 
-        int copyLen = BLOCK_SIZE;
-        if ((size_t)(contentLen - written) < (size_t)copyLen) copyLen = (int)(contentLen - written);
-        if (copyLen > 0) {
-            memcpy(file.virtualDisk[idx], content + written, copyLen);
-            if (copyLen < BLOCK_SIZE) memset(file.virtualDisk[idx] + copyLen, 0, BLOCK_SIZE - copyLen);
-        } else {
-            
-            memset(file.virtualDisk[idx], 0, BLOCK_SIZE);
+        struct iovec *cur = iov;
+        while (n > 0) {
+            ssize_t w = writev(fd, cur, n);
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            while (n > 0 && (size_t)w >= cur->iov_len) {
+                w -= (ssize_t)cur->iov_len;
+                cur++;
+                n--;
+            }
+            if (n > 0) {
+                cur->iov_base = (unsigned char*)cur->iov_base + w;
+                cur->iov_len -= (size_t)w;
+            }
         }
-        written += copyLen;
     }
-    fnode->size = (int)contentLen;
-    printf("Data written successfully (size=%zu bytes).\n", contentLen);
+    return 0;
 }
 
 //read
 void cmd_read(const char *filename) {
     if (!filename || filename[0] == '\0') { printf("read: missing filename\n"); return; }
     FileNode *fnode = findChild(file.cwd, filename);
-    if (!fnode || fnode->isDirectory) { printf("File not found.\n"); return; }
-    if (fnode->blockCount == 0 || fnode->size == 0) { printf("(empty)\n"); return; }
+    if (!fnode || isDirectoryNode(fnode)) { printf("File not found.\n"); return; }
+    FileData *data = fnode->data;
+    if (data->blockCount == 0 || data->size == 0) { printf("(empty)\n"); return; }
 
-    int remaining = fnode->size;
-    for (int i = 0; i < fnode->blockCount; ++i) {
-        int idx = fnode->blockPointers[i];
-        int toPrint = remaining < BLOCK_SIZE ? remaining : BLOCK_SIZE;
-        if (toPrint > 0) fwrite(file.virtualDisk[idx], 1, toPrint, stdout);
-        remaining -= toPrint;
+    fflush(stdout);
+    if (writeFileToFd(data, STDOUT_FILENO) < 0) {
+        printf("read: write failed: %s\n", strerror(errno));
+        return;
     }
     printf("\n");
 }
+
+//copy a file out to the host filesystem
+void cmd_export(const char *filename, const char *hostPath) {
+    if (!filename || filename[0] == '\0' || !hostPath || hostPath[0] == '\0') {
+        printf("export: usage: export <file> <host path>\n");
+        return;
+    }
+    FileNode *fnode = findChild(file.cwd, filename);
+    if (!fnode || isDirectoryNode(fnode)) { printf("File not found.\n"); return; }
+
+    int fd = open(hostPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) { printf("export: cannot open %s: %s\n", hostPath, strerror(errno)); return; }
+    int rc = writeFileToFd(fnode->data, fd);
+    if (close(fd) < 0) rc = -1;
+    if (rc < 0) { printf("export: write failed: %s\n", strerror(errno)); return; }
+    printf("Exported %lld bytes to %s.\n", fnode->data->size, hostPath);
+}
+
+// Reads stdin a line at a time up to a line holding only ".", so the
+// shell can go on reading commands afterwards. EOF also ends the data.
+static int importStdinLines(FileData *d, char *chunk, bool *readError) {
+    char *line = NULL;
+    size_t lineCap = 0;
+    size_t used = 0;
+    ssize_t len;
+    int rc = 0;
+    while (rc == 0 && (len = getline(&line, &lineCap, stdin)) > 0) {
+        if (strcmp(line, ".\n") == 0 || strcmp(line, ".") == 0) break;
+        for (ssize_t off = 0; off < len && rc == 0; ) {
+            size_t n = IMPORT_CHUNK - used;
+            if ((size_t)(len - off) < n) n = (size_t)(len - off);
+            memcpy(chunk + used, line + off, n);
+            used += n;
+            off += n;
+            if (used == IMPORT_CHUNK) {
+                rc = appendBytes(d, chunk, used);
+                used = 0;
+            }
+        }
+    }
+    if (rc == 0 && used > 0) rc = appendBytes(d, chunk, used);
+    *readError = ferror(stdin);
+    clearerr(stdin);
+    free(line);
+    return rc;
+}
+
+//stream a host file (or stdin with "-", ended by a "." line) into a file in fixed-size chunks
+void cmd_import(const char *filename, const char *hostPath) {
+    if (!filename || filename[0] == '\0' || !hostPath || hostPath[0] == '\0') {
+        printf("import: usage: import <file> <host path | ->\n");
+        return;
+    }
+    FileNode *fnode = findChild(file.cwd, filename);
+    if (!fnode || isDirectoryNode(fnode)) { printf("File not found.\n"); return; }
+
+    bool fromStdin = (strcmp(hostPath, "-") == 0);
+    FILE *in = fromStdin ? stdin : fopen(hostPath, "rb");
+    if (!in) { printf("import: cannot open %s: %s\n", hostPath, strerror(errno)); return; }
+    char *chunk = (char*)malloc(IMPORT_CHUNK);
+    if (!chunk) {
+        if (!fromStdin) fclose(in);
+        printf("import: allocation failed\n");
+        return;
+    }
+
+    freeFileBlocks(fnode);
+    int rc = 0;
+    bool readError;
+    if (fromStdin) {
+        printf("Reading stdin; end with a line containing only '.'\n");
+        rc = importStdinLines(fnode->data, chunk, &readError);
+    } else {
+        size_t got;
+        while ((got = fread(chunk, 1, IMPORT_CHUNK, in)) > 0) {
+            rc = appendBytes(fnode->data, chunk, got);
+            if (rc < 0) break;
+        }
+        readError = ferror(in);
+    }
+    free(chunk);
+    if (!fromStdin) fclose(in);
+
+    if (rc < 0) printf("import: disk full, stopped after %lld bytes.\n", fnode->data->size);
+    else if (readError) printf("import: read error after %lld bytes.\n", fnode->data->size);
+    else printf("Imported %lld bytes from %s.\n", fnode->data->size, hostPath);
+}
 //delete a file
 void cmd_delete(const char *filename) {
     if (!filename || filename[0] == '\0') { printf("delete: missing filename\n"); return; }
     FileNode *fnode = findChild(file.cwd, filename);
     if (!fnode) { printf("File not found.\n"); return; }
-    if (fnode->isDirectory) { printf("Target is a directory. Use rmdir to remove directories.\n"); return; }
+    if (isDirectoryNode(fnode)) { printf("Target is a directory. Use rmdir to remove directories.\n"); return; }
 
-    freeFileBlocks(fnode);
-    free(fnode->blockPointers);
     removeChildFromParent(fnode);
     destroyNode(fnode);
     printf("File deleted successfully.\n");
@@ -436,7 +850,7 @@ void cmd_rmdir(const char *dirname) {
     if (!dirname || dirname[0] == '\0') { printf("rmdir: missing name\n"); return; }
     FileNode *d = findChild(file.cwd, dirname);
     if (!d) { printf("Directory not found.\n"); return; }
-    if (!d->isDirectory) { printf("Not a directory.\n"); return; }
+    if (!isDirectoryNode(d)) { printf("Not a directory.\n"); return; }
     if (d->child) { printf("Directory not empty. Remove files first.\n"); return; }
 
     removeChildFromParent(d);
@@ -444,14 +858,198 @@ void cmd_rmdir(const char *dirname) {
     printf("Directory removed successfully.\n");
 }
 
+typedef struct FragStats {
+    int files;
+    int fragmentedFiles;
+    int usedBlocks;
+    int extents;
+    int freeExtents;
+    int largestFreeRun;
+} FragStats;
+
+static void collectFragStats(FragStats *st) {
+    memset(st, 0, sizeof(*st));
+    for (FileNode *n = file.root; n; n = nextPreorder(n)) {
+        if (isDirectoryNode(n) || n->data->blockCount == 0) continue;
+        FileData *d = n->data;
+        int runs = 1;
+        for (int i = 1; i < d->blockCount; ++i) {
+            if (d->blockPointers[i] != d->blockPointers[i - 1] + 1) runs++;
+        }
+        st->files++;
+        st->usedBlocks += d->blockCount;
+        st->extents += runs;
+        if (runs > 1) st->fragmentedFiles++;
+    }
+
+    bool *isFree = (bool*)calloc(file.numBlocks, sizeof(bool));
+    if (!isFree) return;
+    for (int i = 0; i < file.freeCount; ++i) {
+        isFree[file.freeRing[(file.freeHeadPos + i) % file.numBlocks]] = true;
+    }
+    int run = 0;
+    for (int i = 0; i <= file.numBlocks; ++i) {
+        if (i < file.numBlocks && isFree[i]) {
+            if (run == 0) st->freeExtents++;
+            run++;
+            if (run > st->largestFreeRun) st->largestFreeRun = run;
+        } else {
+            run = 0;
+        }
+    }
+    free(isFree);
+}
+
+// Moves block i of d to target. Whatever sits at target, another file's
+// block or one of d's own, is swapped into the block d leaves behind, so
+// the owner maps stay exact. Returns 1 if a block moved.
+static int moveDefragBlock(FileData **owner, int *ownerPos, FileData *d, int i, int target) {
+    int src = d->blockPointers[i];
+    if (src == target) return 0;
+    FileData *other = owner[target];
+    if (other) {
+        unsigned char tmp[BLOCK_SIZE];
+        int pos = ownerPos[target];
+        memcpy(tmp, file.virtualDisk[target], BLOCK_SIZE);
+        memcpy(file.virtualDisk[target], file.virtualDisk[src], BLOCK_SIZE);
+        memcpy(file.virtualDisk[src], tmp, BLOCK_SIZE);
+        other->blockPointers[pos] = src;
+        owner[src] = other;
+        ownerPos[src] = pos;
+    } else {
+        memcpy(file.virtualDisk[target], file.virtualDisk[src], BLOCK_SIZE);
+        owner[src] = NULL;
+    }
+    d->blockPointers[i] = target;
+    owner[target] = d;
+    ownerPos[target] = i;
+    return 1;
+}
+
+// Finds a window of len blocks starting in [from, to) that holds only free
+// blocks or blocks already owned by d, or returns -1.
+static int findDefragWindow(FileData **owner, FileData *d, int len, int from, int to) {
+    int bad = 0;
+    int end = to + len - 1 < file.numBlocks ? to + len - 1 : file.numBlocks;
+    for (int i = from; i < end; ++i) {
+        if (owner[i] && owner[i] != d) bad++;
+        if (i - len >= from && owner[i - len] && owner[i - len] != d) bad--;
+        if (i - from >= len - 1 && bad == 0) return i - len + 1;
+    }
+    return -1;
+}
+
+static bool isContiguous(const FileData *d) {
+    for (int i = 1; i < d->blockCount; ++i) {
+        if (d->blockPointers[i] != d->blockPointers[i - 1] + 1) return false;
+    }
+    return true;
+}
+
+// Makes fragmented files contiguous in two passes. The first moves each
+// one into a window of free blocks and its own blocks, searching on from
+// where the last window ended so the disk is not rescanned per file. If
+// fragmented files are left, or the free space is split into runs, the
+// second slides every file down over the owner map in address order,
+// swapping whatever is in the way into the space just vacated, so files
+// end up packed at the front and the free space in one run at the end.
+static int defragment() {
+    FileData **owner = (FileData**)calloc(file.numBlocks, sizeof(FileData*));
+    int *ownerPos = (int*)malloc(sizeof(int) * (size_t)file.numBlocks);
+    if (!owner || !ownerPos) {
+        free(owner);
+        free(ownerPos);
+        return -1;
+    }
+    for (FileNode *n = file.root; n; n = nextPreorder(n)) {
+        if (isDirectoryNode(n)) continue;
+        for (int i = 0; i < n->data->blockCount; ++i) {
+            owner[n->data->blockPointers[i]] = n->data;
+            ownerPos[n->data->blockPointers[i]] = i;
+        }
+    }
+
+    int moved = 0;
+    int cursor = 0;
+    int failedLen = file.numBlocks + 1;
+    int fragmented = 0;
+    for (FileNode *n = file.root; n; n = nextPreorder(n)) {
+        if (isDirectoryNode(n) || isContiguous(n->data)) continue;
+        FileData *d = n->data;
+        int len = d->blockCount;
+        int start = -1;
+        if (len < failedLen) {
+            start = findDefragWindow(owner, d, len, cursor, file.numBlocks);
+            if (start < 0) start = findDefragWindow(owner, d, len, 0, cursor);
+        }
+        if (start < 0) {
+            if (len < failedLen) failedLen = len;
+            fragmented++;
+            continue;
+        }
+        for (int i = 0; i < len; ++i) {
+            moved += moveDefragBlock(owner, ownerPos, d, i, start + i);
+        }
+        cursor = start + len < file.numBlocks ? start + len : 0;
+    }
+
+    int freeBlocks = 0, run = 0, largestFreeRun = 0;
+    for (int i = 0; i < file.numBlocks; ++i) {
+        run = owner[i] ? 0 : run + 1;
+        if (!owner[i]) freeBlocks++;
+        if (run > largestFreeRun) largestFreeRun = run;
+    }
+    if (fragmented > 0 || largestFreeRun < freeBlocks) {
+        // Blocks below next belong to files already placed and those in
+        // [next, i) are free, so the first block met past next is the
+        // lowest of a file not yet placed.
+        int next = 0;
+        for (int i = 0; i < file.numBlocks; ++i) {
+            if (i < next || !owner[i]) continue;
+            FileData *d = owner[i];
+            for (int k = 0; k < d->blockCount; ++k) {
+                moved += moveDefragBlock(owner, ownerPos, d, k, next + k);
+            }
+            next += d->blockCount;
+        }
+    }
+
+    file.freeHeadPos = 0;
+    file.freeCount = 0;
+    for (int i = 0; i < file.numBlocks; ++i) {
+        if (!owner[i]) addFreeBlockTail(i);
+    }
+    free(owner);
+    free(ownerPos);
+    return moved;
+}
+
+void cmd_defrag() {
+    FragStats before, after;
+    collectFragStats(&before);
+    int moved = defragment();
+    if (moved < 0) { printf("defrag: allocation failed\n"); return; }
+    collectFragStats(&after);
+    printf("Defragmentation complete: %d blocks moved, extents %d -> %d.\n",
+           moved, before.extents, after.extents);
+}
+
 void cmd_df() {
     int freeCount = countFreeBlocks();
-    int used = NUM_BLOCKS - freeCount;
-    double usagePercent = ((double)used / (double)NUM_BLOCKS) * 100.0;
-    printf("Total Blocks: %d\n", NUM_BLOCKS);
+    int used = file.numBlocks - freeCount;
+    double usagePercent = ((double)used / (double)file.numBlocks) * 100.0;
+    printf("Total Blocks: %d\n", file.numBlocks);
     printf("Used Blocks: %d\n", used);
     printf("Free Blocks: %d\n", freeCount);
     printf("Disk Usage: %.2f%%\n", usagePercent);
+
+    FragStats st;
+    collectFragStats(&st);
+    double fragPercent = (st.usedBlocks > st.files)
+        ? ((double)(st.extents - st.files) / (double)(st.usedBlocks - st.files)) * 100.0 : 0.0;
+    printf("Fragmented Files: %d of %d\n", st.fragmentedFiles, st.files);
+    printf("File Extents: %d (%.2f%% fragmented)\n", st.extents, fragPercent);
+    printf("Free Extents: %d (largest run %d blocks)\n", st.freeExtents, st.largestFreeRun);
 }
 
 
@@ -465,13 +1063,20 @@ void trim(char *s) {
     while (len > 0 && isspace((unsigned char)s[len - 1])) { s[len - 1] = '\0'; len--; }
 }
 
+// Cuts the first word off *rest in place and returns it.
+static char* takeWord(char **rest) {
+    char *word = *rest;
+    char *p = word;
+    while (*p && !isspace((unsigned char)*p)) p++;
+    if (*p) *p++ = '\0';
+    while (*p && isspace((unsigned char)*p)) p++;
+    *rest = p;
+    return word;
+}
 
 void handle_line(char *input) {
     if (!input) return;
-    char line[LINE_BUF];
-    
-    strncpy(line, input, LINE_BUF - 1);
-    line[LINE_BUF - 1] = '\0';
+    char *line = input;
     trim(line);
     if (strlen(line) == 0) return;
 
@@ -501,9 +1106,7 @@ void handle_line(char *input) {
         cmd_pwd();
     } else if (strcmp(cmd, "write") == 0) {
         
-        char fname[256] = "";
-        char content[LINE_BUF];
-        content[0] = '\0';
+        char fname[MAX_NAME + 1] = "";
 
         
         int i = 0;
@@ -526,25 +1129,26 @@ void handle_line(char *input) {
                 printf("write: missing closing quote\n");
                 return;
             }
-            size_t copyLen = (size_t)(endq - rest);
-            if (copyLen >= sizeof(content)) copyLen = sizeof(content)-1;
-            memcpy(content, rest, copyLen);
-            content[copyLen] = '\0';
-        } else {
-            
-            strncpy(content, rest, sizeof(content)-1);
-            content[sizeof(content)-1] = '\0';
+            *endq = '\0';
         }
 
-        cmd_write(fname, content);
+        cmd_write(fname, rest);
     } else if (strcmp(cmd, "read") == 0) {
         cmd_read(rest);
+    } else if (strcmp(cmd, "export") == 0) {
+        char *fname = takeWord(&rest);
+        cmd_export(fname, rest);
+    } else if (strcmp(cmd, "import") == 0) {
+        char *fname = takeWord(&rest);
+        cmd_import(fname, rest);
     } else if (strcmp(cmd, "delete") == 0) {
         cmd_delete(rest);
     } else if (strcmp(cmd, "rmdir") == 0) {
         cmd_rmdir(rest);
     } else if (strcmp(cmd, "df") == 0) {
         cmd_df();
+    } else if (strcmp(cmd, "defrag") == 0) {
+        cmd_defrag();
     } else if (strcmp(cmd, "exit") == 0) {
         printf("Memory released. Exiting program...\n");
         cleanupFS();
@@ -554,21 +1158,26 @@ void handle_line(char *input) {
     }
 }
 
+// vfs_benchmark.c includes this file and supplies its own main.
+#ifndef VFS_NO_MAIN
 int main(void) {
     initFS();
     printf("Compact VFS - ready. Type 'exit' to quit.\n");
 
-    char line[LINE_BUF];
+    char *line = NULL;
+    size_t lineCap = 0;
 
     while (1) {
         if (file.cwd == file.root) printf("/ > ");
         else printf("%s > ", file.cwd->name);
 
-        if (!fgets(line, sizeof(line), stdin)) break;
-        
+        if (getline(&line, &lineCap, stdin) < 0) break;
+
         line[strcspn(line, "\n")] = '\0';
         handle_line(line);
     }
+    free(line);
     cleanupFS();
     return 0;
 }
+#endif
@@ -0,0 +1,264 @@
+// Microbenchmarks for the VFS. Build with:
+//   gcc -O2 -o vfs_benchmark vfs_benchmark.c
+// Usage: ./vfs_benchmark [scale] [seed] [importMB]
+#define VFS_NO_MAIN
+#include "VirtualFileSystem.c"
+
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_CONTENT (INITIAL_BLOCKS * BLOCK_SIZE)
+#define DEFAULT_IMPORT_MB 32
+
+static FILE *report;
+static char *content;
+static char nameBuf[64];
+
+static double nowSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char* nameFor(const char *prefix, int i) {
+    snprintf(nameBuf, sizeof(nameBuf), "%s%d", prefix, i);
+    return nameBuf;
+}
+
+// cmd_write takes a C string, so terminate the shared buffer at len for one call.
+static void writeBytes(const char *name, int len) {
+    char saved = content[len];
+    content[len] = '\0';
+    cmd_write(name, content);
+    content[len] = saved;
+}
+
+static void resetFS() {
+    cleanupFS();
+    initFS();
+}
+
+static void printResult(const char *label, long ops, long long bytes, double secs) {
+    if (secs <= 0) secs = 1e-9;
+    fprintf(report, "%-32s %10ld ops %12.0f ops/s", label, ops, ops / secs);
+    if (bytes > 0) fprintf(report, " %10.1f MB/s", bytes / secs / (1024.0 * 1024.0));
+    fprintf(report, "\n");
+}
+
+static void printAllocatorStats(const char *label) {
+    FragStats st;
+    collectFragStats(&st);
+    fprintf(report, "  [%s] nodes=%zu (%zu chunks) fileData=%zu (%zu chunks) names=%zu (%zu bytes)\n",
+            label, file.nodePool.live, file.nodePool.chunkCount,
+            file.dataPool.live, file.dataPool.chunkCount,
+            file.names.count, file.names.bytes);
+    fprintf(report, "  [%s] usedBlocks=%d freeBlocks=%d files=%d extents=%d (%.2f per file) freeExtents=%d\n",
+            label, file.numBlocks - countFreeBlocks(), countFreeBlocks(), st.files, st.extents,
+            st.files ? (double)st.extents / st.files : 0.0, st.freeExtents);
+}
+
+static void benchFlat(int n) {
+    double t0 = nowSeconds();
+    for (int i = 0; i < n; ++i) cmd_create(nameFor("f", i));
+    printResult("create (flat)", n, 0, nowSeconds() - t0);
+
+    int found = 0;
+    t0 = nowSeconds();
+    for (int i = 0; i < n; ++i) {
+        if (findChild(file.cwd, nameFor("f", rand() % n))) found++;
+    }
+    printResult("lookup (flat, random)", n, 0, nowSeconds() - t0);
+    if (found != n) fprintf(report, "  lookup mismatch: %d of %d found\n", found, n);
+
+    t0 = nowSeconds();
+    for (int i = 0; i < n; ++i) cmd_delete(nameFor("f", i));
+    printResult("delete (flat)", n, 0, nowSeconds() - t0);
+    resetFS();
+}
+
+static void benchDeep(int depth) {
+    double t0 = nowSeconds();
+    for (int i = 0; i < depth; ++i) {
+        cmd_mkdir(nameFor("d", i));
+        cmd_cd(nameFor("d", i));
+    }
+    printResult("mkdir+cd (deep)", depth, 0, nowSeconds() - t0);
+
+    t0 = nowSeconds();
+    for (int i = 0; i < 100; ++i) cmd_pwd();
+    printResult("pwd (deep)", 100, 0, nowSeconds() - t0);
+    printAllocatorStats("deep");
+
+    t0 = nowSeconds();
+    for (int i = depth - 1; i >= 0; --i) {
+        cmd_cd("..");
+        cmd_rmdir(nameFor("d", i));
+    }
+    printResult("cd ..+rmdir (deep)", depth, 0, nowSeconds() - t0);
+    resetFS();
+}
+
+static void benchWrites(const char *label, int files, int rounds, int minLen, int maxLen, bool randomSizes) {
+    for (int i = 0; i < files; ++i) cmd_create(nameFor("w", i));
+
+    long long bytes = 0;
+    long ops = 0;
+    double t0 = nowSeconds();
+    for (int r = 0; r < rounds; ++r) {
+        for (int i = 0; i < files; ++i) {
+            int len = randomSizes ? minLen + rand() % (maxLen - minLen + 1)
+                                  : minLen + (int)((long long)(maxLen - minLen) * i / (files > 1 ? files - 1 : 1));
+            writeBytes(nameFor("w", i), len);
+            bytes += len;
+            ops++;
+        }
+    }
+    char buf[64];
+    snprintf(buf, sizeof(buf), "write (%s)", label);
+    printResult(buf, ops, bytes, nowSeconds() - t0);
+
+    bytes = 0;
+    t0 = nowSeconds();
+    for (int r = 0; r < rounds; ++r) {
+        for (int i = 0; i < files; ++i) {
+            FileNode *f = findChild(file.cwd, nameFor("w", i));
+            bytes += f->data->size;
+            cmd_read(f->name);
+        }
+    }
+    snprintf(buf, sizeof(buf), "read (%s)", label);
+    printResult(buf, (long)rounds * files, bytes, nowSeconds() - t0);
+    resetFS();
+}
+
+static void benchReadAll(const char *label, const bool *live, int slots) {
+    long long bytes = 0;
+    int reads = 0;
+    double t0 = nowSeconds();
+    for (int r = 0; r < 50; ++r) {
+        for (int s = 0; s < slots; ++s) {
+            if (!live[s]) continue;
+            FileNode *f = findChild(file.cwd, nameFor("c", s));
+            bytes += f->data->size;
+            cmd_read(f->name);
+            reads++;
+        }
+    }
+    printResult(label, reads, bytes, nowSeconds() - t0);
+}
+
+// Random create/write/delete until the free list is thoroughly shuffled,
+// then measure how scattered the surviving files are.
+static void benchChurn(int ops) {
+    int slots = 64;
+    bool *live = (bool*)calloc(slots, sizeof(bool));
+    double t0 = nowSeconds();
+    for (int i = 0; i < ops; ++i) {
+        int s = rand() % slots;
+        const char *name = nameFor("c", s);
+        if (live[s] && rand() % 3 == 0) {
+            cmd_delete(name);
+            live[s] = false;
+        } else {
+            if (!live[s]) {
+                cmd_create(name);
+                live[s] = true;
+            }
+            writeBytes(name, rand() % (MAX_CONTENT / (slots * 2)));
+        }
+    }
+    printResult("churn (create/write/delete)", ops, 0, nowSeconds() - t0);
+    printAllocatorStats("churn");
+
+    benchReadAll("read after churn", live, slots);
+
+    t0 = nowSeconds();
+    cmd_defrag();
+    printResult("defrag", 1, (long long)(file.numBlocks - countFreeBlocks()) * BLOCK_SIZE, nowSeconds() - t0);
+    printAllocatorStats("defrag");
+    benchReadAll("read after defrag", live, slots);
+    free(live);
+    resetFS();
+}
+
+// Streams a host file through cmd_import, growing the disk from its
+// initial size, then sends it back out through cmd_export to a second
+// host file so the writes really reach the page cache.
+static void benchImport(long long bytes) {
+    char hostPath[] = "/tmp/vfs_benchXXXXXX";
+    char exportPath[] = "/tmp/vfs_exportXXXXXX";
+    int fd = mkstemp(hostPath);
+    if (fd < 0) {
+        fprintf(report, "import: cannot create temp file\n");
+        return;
+    }
+    int exportFd = mkstemp(exportPath);
+    if (exportFd < 0) {
+        fprintf(report, "export: cannot create temp file\n");
+        close(fd);
+        unlink(hostPath);
+        return;
+    }
+    close(exportFd);
+    for (long long done = 0; done < bytes; done += MAX_CONTENT) {
+        size_t n = (bytes - done < MAX_CONTENT) ? (size_t)(bytes - done) : MAX_CONTENT;
+        if (write(fd, content, n) != (ssize_t)n) break;
+    }
+    close(fd);
+
+    cmd_create("big");
+    double t0 = nowSeconds();
+    cmd_import("big", hostPath);
+    printResult("import (streamed, growing disk)", 1, bytes, nowSeconds() - t0);
+    printAllocatorStats("import");
+
+    t0 = nowSeconds();
+    cmd_export("big", exportPath);
+    printResult("export (writev)", 1, bytes, nowSeconds() - t0);
+    unlink(hostPath);
+    unlink(exportPath);
+    resetFS();
+}
+
+int main(int argc, char *argv[]) {
+    int scale = (argc > 1) ? atoi(argv[1]) : 1;
+    unsigned int seed = (argc > 2) ? (unsigned int)atoi(argv[2]) : 42;
+    int importMB = (argc > 3) ? atoi(argv[3]) : DEFAULT_IMPORT_MB;
+    if (scale < 1) scale = 1;
+    if (importMB < 0) importMB = 0;
+    srand(seed);
+
+    // Command output goes to /dev/null; results go to the original stdout.
+    int reportFd = dup(STDOUT_FILENO);
+    report = fdopen(reportFd, "w");
+    if (!report || !freopen("/dev/null", "w", stdout)) {
+        fprintf(stderr, "Failed to redirect output\n");
+        return EXIT_FAILURE;
+    }
+
+    content = (char*)malloc(MAX_CONTENT + 1);
+    if (!content) {
+        fprintf(stderr, "malloc failed\n");
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < MAX_CONTENT; ++i) content[i] = (char)('a' + i % 26);
+    content[MAX_CONTENT] = '\0';
+
+    fprintf(report, "VFS benchmark: scale=%d seed=%u importMB=%d initialBlocks=%d blockSize=%d\n\n",
+            scale, seed, importMB, INITIAL_BLOCKS, BLOCK_SIZE);
+
+    initFS();
+    benchFlat(2000 * scale);
+    benchDeep(5000 * scale);
+    benchWrites("small, sequential sizes", 500, 20 * scale, 1, BLOCK_SIZE, false);
+    benchWrites("small, random sizes", 500, 20 * scale, 1, BLOCK_SIZE, true);
+    benchWrites("large, sequential sizes", 8, 20 * scale, MAX_CONTENT / 32, MAX_CONTENT / 9, false);
+    benchWrites("large, random sizes", 8, 20 * scale, MAX_CONTENT / 32, MAX_CONTENT / 9, true);
+    benchChurn(20000 * scale);
+    if (importMB > 0) benchImport((long long)importMB * 1024 * 1024);
+    cleanupFS();
+
+    free(content);
+    fclose(report);
+    return 0;
+}
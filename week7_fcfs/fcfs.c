@@ -2,9 +2,19 @@
 #include<stdlib.h>
 #include<string.h>
 #include<stdbool.h>
+#include<stdint.h>
+#include<pthread.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
 
 #define SIZE 100
-#define HASH_SIZE 11
+#define PID_SLOTS_INIT 16
+#define MAX_IO_PHASES 32
+#define MAX_CPUS 256
+#define OUTPUT_BUFFER_SIZE (1 << 16)
+#define MAX_SWEEP_VALUES 32
 
 typedef enum ProcessState {
     READY,
@@ -14,7 +24,16 @@ typedef enum ProcessState {
     KILLED
 } ProcessState;
 
+typedef struct IoPhase {
+    unsigned int start;
+    unsigned int duration;
+} IoPhase;
+
+// ioStartTime is the CPU offset of the next I/O phase still to run and
+// ioDuration the total over all phases; the phases themselves sit in the
+// process table at [ioPhase, ioPhaseEnd).
 typedef struct ProcessControlBlock {
+    int processId;
     char name[SIZE + 1];
     unsigned int burstTime;
     unsigned int remBurstTime;
@@ -24,29 +43,40 @@ typedef struct ProcessControlBlock {
     unsigned int cpuExecuted;
 
     ProcessState state;
-    int turnAroundTime;
-    int waitingTime;
-    bool ioStartedThisTick;
+    long long turnAroundTime;
+    long long waitingTime;
+    bool ioPending;
+    int priority;
+    int level;
+    long long runStart;
+    long long firstRun;
+    long long ioSince;
+    int ioPhase;
+    int ioPhaseEnd;
+    int cpu;
+    struct ProcessControlBlock* queueNext;
+    struct ProcessControlBlock* queuePrev;
+    int heapIndex;
 } ProcessControlBlock;
 
-typedef struct HashNode {
-    int key;
-    ProcessControlBlock* value;
-    struct HashNode* next;
-} HashNode;
-
-typedef struct HashMap {
-    HashNode* buckets[HASH_SIZE];
-} HashMap;
-
-typedef struct Node {
-    int processId;
-    struct Node* next;
-} Node;
-
+// PCBs live in one array in input order; slots is an open-addressing
+// index from pid to array position + 1, with 0 marking an empty slot.
+typedef struct ProcessTable {
+    ProcessControlBlock* pcbs;
+    int count;
+    int capacity;
+    int* slots;
+    int slotCount;
+    IoPhase* ioPhases;
+    int ioPhaseCount;
+    int ioPhaseCapacity;
+} ProcessTable;
+
+// Ready queues are intrusive: the links live in the PCB, so moving a
+// process between queues never allocates.
 typedef struct Queue {
-    Node* front;
-    Node* rear;
+    ProcessControlBlock* front;
+    ProcessControlBlock* rear;
 } Queue;
 
 typedef struct KillEvent {
@@ -54,189 +84,471 @@ typedef struct KillEvent {
     int time;
 } KillEvent;
 
-HashMap* createHashMap() {
-    HashMap* temp = malloc(sizeof(HashMap));
-    if (!temp){
-        printf("Memory Allocation Failed!\n");
+
+typedef enum EventType {
+    CPU_DONE,
+    IO_DONE,
+    TIMER
+} EventType;
+
+// Binary min-heap entry ordered by (key, tag, seq). The event queue stores
+// time and event type there; ready heaps store a policy-specific key.
+typedef struct HeapItem {
+    long long key;
+    int tag;
+    long long seq;
+    int processId;
+    ProcessControlBlock* pcb;
+} HeapItem;
+
+// An indexed heap keeps each item's pcb->heapIndex current so a process
+// can be removed without searching; at most one entry per PCB, and items
+// without a PCB (policy timers) are not tracked.
+typedef struct MinHeap {
+    HeapItem* items;
+    int size;
+    int capacity;
+    bool indexed;
+} MinHeap;
+
+typedef enum PolicyKind {
+    POLICY_FCFS,
+    POLICY_SJF,
+    POLICY_SRTF,
+    POLICY_RR,
+    POLICY_PRIORITY,
+    POLICY_MLFQ
+} PolicyKind;
+
+typedef enum BalanceMode {
+    BALANCE_PUSH,
+    BALANCE_STEAL,
+    BALANCE_AFFINITY
+} BalanceMode;
+
+typedef struct SchedulerConfig {
+    PolicyKind kind;
+    unsigned int quantum;
+    unsigned int agingInterval;
+    int mlfqLevels;
+    unsigned int boostInterval;
+    int cpuCount;
+    BalanceMode balance;
+} SchedulerConfig;
+
+typedef struct Policy Policy;
+
+// Hooks a scheduling policy provides to the simulation engine. timeSlice
+// returns 0 for run-until-block, shouldPreempt and onTick may be NULL.
+typedef struct PolicyOps {
+    const char* name;
+    void (*onArrival)(Policy* policy, ProcessControlBlock* pcb, int processId, long long clock);
+    ProcessControlBlock* (*pickNext)(Policy* policy, long long clock);
+    void (*onPreempt)(Policy* policy, ProcessControlBlock* pcb, int processId, long long clock, bool quantumExpired);
+    bool (*remove)(Policy* policy, ProcessControlBlock* pcb, int processId);
+    unsigned int (*timeSlice)(Policy* policy, ProcessControlBlock* pcb);
+    bool (*shouldPreempt)(Policy* policy, ProcessControlBlock* running, ProcessControlBlock* arriving, long long clock);
+    void (*onTick)(Policy* policy, ProcessControlBlock* running, long long clock);
+} PolicyOps;
+
+#define MAX_MLFQ_LEVELS 8
+
+struct Policy {
+    const PolicyOps* ops;
+    SchedulerConfig config;
+    Queue levels[MAX_MLFQ_LEVELS];
+    int levelCount;
+    MinHeap* heap;
+    long long seq;
+};
+
+typedef struct CpuStats {
+    long long busyTime;
+    long long dispatches;
+    long long steals;
+    long long contextSwitches;
+} CpuStats;
+
+// A simulated CPU with its own run queue, which is a private instance of
+// the configured policy.
+typedef struct Cpu {
+    Policy* policy;
+    int runningProcessId;
+    int readyCount;
+    int lastProcessId;
+    CpuStats stats;
+} Cpu;
+
+// Non-interactive mode: --trace loads a CSV or binary trace, results go
+// to --output (stdout by default) and --dump-trace converts to binary.
+// --metrics and --timeline work in either mode.
+typedef struct RunOptions {
+    const char* tracePath;
+    const char* outputPath;
+    const char* dumpPath;
+    bool binaryOutput;
+    const char* sweepSpec;
+    int threads;
+    bool metrics;
+    const char* timelinePath;
+} RunOptions;
+
+typedef enum SliceKind {
+    SLICE_RUN,
+    SLICE_IO
+} SliceKind;
+
+// One stretch of CPU or I/O time; I/O slices have cpu -1.
+typedef struct TimelineSlice {
+    long long start;
+    long long end;
+    int processId;
+    short cpu;
+    short kind;
+} TimelineSlice;
+
+typedef struct Timeline {
+    TimelineSlice* slices;
+    int count;
+    int capacity;
+} Timeline;
+
+// One point of a parameter sweep and the averages it produced.
+typedef struct SweepRun {
+    SchedulerConfig config;
+    long long makespan;
+    double averageTurnaround;
+    double averageWaiting;
+    double throughput;
+    int completed;
+    int killed;
+    bool ok;
+} SweepRun;
+
+// Shared by the sweep workers; each claims the next run index under the
+// lock and simulates it on private copies of the trace.
+typedef struct SweepQueue {
+    const ProcessTable* trace;
+    const KillEvent* kills;
+    int killCount;
+    SweepRun* runs;
+    int runCount;
+    int nextRun;
+    pthread_mutex_t lock;
+} SweepQueue;
+
+typedef struct OutputBuffer {
+    int fd;
+    char* data;
+    size_t used;
+    bool failed;
+} OutputBuffer;
+
+// Binary traces are "FCFT", version, process count and kill count, then
+// per process: pid, burst, priority, name length, phase count, the name
+// bytes and (start, duration) pairs; then (pid, time) per kill. All
+// fields are in host byte order.
+typedef struct TraceHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t processCount;
+    uint32_t killCount;
+} TraceHeader;
+
+typedef struct TraceProcess {
+    int32_t processId;
+    uint32_t burstTime;
+    int32_t priority;
+    uint16_t nameLength;
+    uint16_t phaseCount;
+} TraceProcess;
+
+// Binary results are "FCFR", version, count, then one record per process
+// in PID order.
+typedef struct ResultRecord {
+    int32_t processId;
+    uint32_t burstTime;
+    uint32_t ioDuration;
+    uint32_t status;
+    int64_t turnAroundTime;
+    int64_t waitingTime;
+} ResultRecord;
+
+// Set recordTimeline before the run to have every slice kept in timeline;
+// the caller frees timeline.slices.
+typedef struct SimulationReport {
+    long long makespan;
+    long long migrations;
+    int cpuCount;
+    CpuStats cpus[MAX_CPUS];
+    bool recordTimeline;
+    Timeline timeline;
+} SimulationReport;
+
+typedef struct Simulation {
+    ProcessTable* table;
+    Cpu* cpus;
+    int cpuCount;
+    BalanceMode balance;
+    long long migrations;
+    MinHeap* events;
+    Timeline* timeline;
+    KillEvent* kills;
+    int killCount;
+    int killCursor;
+    long long seq;
+    long long clock;
+    int terminatedCount;
+    int totalProcesses;
+} Simulation;
+
+// Sizes are computed in size_t so a large capacity is refused instead of
+// overflowing the int slot count.
+ProcessTable* createProcessTable(size_t capacity) {
+    size_t slotCount = PID_SLOTS_INIT;
+    if (capacity == 0){
+        capacity = 1;
+    }
+    while (slotCount < 2 * capacity && slotCount <= INT32_MAX / 2){
+        slotCount <<= 1;
+    }
+    if (slotCount < 2 * capacity){
+        printf("Too many processes!\n");
         return NULL;
     }
 
-    for (int index = 0; index < HASH_SIZE; index++){
-        temp->buckets[index] = NULL;
+    ProcessTable* table = calloc(1, sizeof(ProcessTable));
+    if (!table){
+        printf("Memory Allocation Failed!\n");
+        return NULL;
     }
 
-    return temp;
-}
-
-HashNode* createHashNode(int key, ProcessControlBlock* pcb) {
-    HashNode* newNode = malloc(sizeof(HashNode));
-    if (!newNode){
+    table->capacity = (int)capacity;
+    table->slotCount = (int)slotCount;
+    table->pcbs = malloc(sizeof(ProcessControlBlock) * capacity);
+    table->slots = calloc(slotCount, sizeof(int));
+    if (!table->pcbs || !table->slots){
         printf("Memory Allocation Failed!\n");
+        free(table->pcbs);
+        free(table->slots);
+        free(table);
         return NULL;
     }
 
-    newNode->key = key;
-    newNode->value = pcb;
-    newNode->next = NULL;
+    return table;
+}
 
-    return newNode;
+// Fibonacci hashing spreads sequential pids across the table.
+int pidSlot(int processId, int slotCount) {
+    return (int)(((unsigned int)processId * 2654435769u) & (unsigned int)(slotCount - 1));
 }
 
-int hash(int key) {
-    return (key % HASH_SIZE + HASH_SIZE) % HASH_SIZE;
+// Returns the slot holding processId, or the empty slot where it belongs.
+int findPidSlot(ProcessTable* table, int processId) {
+    int slot = pidSlot(processId, table->slotCount);
+    while (table->slots[slot] != 0 && table->pcbs[table->slots[slot] - 1].processId != processId){
+        slot = (slot + 1) & (table->slotCount - 1);
+    }
+    return slot;
 }
 
-void insertIntoHashMap(HashMap* hashMap, int key, ProcessControlBlock* pcb) {
-    if (!hashMap || !pcb){
-        return;
+bool growPidSlots(ProcessTable* table) {
+    int* oldSlots = table->slots;
+    int oldCount = table->slotCount;
+    if (oldCount > INT32_MAX / 2){
+        return false;
     }
 
-    int index = hash(key);
+    table->slots = calloc((size_t)oldCount * 2, sizeof(int));
+    if (!table->slots){
+        table->slots = oldSlots;
+        return false;
+    }
+    table->slotCount = oldCount * 2;
 
-    HashNode* newNode = createHashNode(key, pcb);
-    newNode->next = hashMap->buckets[index];
-    hashMap->buckets[index] = newNode;
+    for (int index = 0; index < table->count; index++){
+        table->slots[findPidSlot(table, table->pcbs[index].processId)] = index + 1;
+    }
+    free(oldSlots);
+    return true;
 }
 
-ProcessControlBlock* getFromHashMap(HashMap* hashMap, int key) {
-    if (!hashMap){
+ProcessControlBlock* lookupProcess(ProcessTable* table, int processId) {
+    if (!table){
         return NULL;
     }
 
-    int index = hash(key);
-    HashNode* temp = hashMap->buckets[index];
-    while(temp){
-        if (temp->key == key){
-            return temp->value;
-        }
-        temp = temp->next;
-    }
-
-    return NULL;
+    int position = table->slots[findPidSlot(table, processId)];
+    return (position == 0) ? NULL : &table->pcbs[position - 1];
 }
 
-void freeHashMap(HashMap* hashMap) {
-    if (!hashMap){
-        return;
+// The returned PCB is only valid until the next addProcess, which may
+// move the array; the simulation runs after all processes are added.
+ProcessControlBlock* addProcess(ProcessTable* table, int processId) {
+    if (!table || lookupProcess(table, processId)){
+        return NULL;
     }
 
-    for (int index = 0; index < HASH_SIZE; index++){
-        HashNode* temp = hashMap->buckets[index];
-        while (temp){
-            HashNode* toDelete = temp;
-            temp = temp->next;
-            free(toDelete->value);
-            free(toDelete);
+    if (table->count == table->capacity){
+        if (table->capacity > INT32_MAX / 2){
+            printf("Too many processes!\n");
+            return NULL;
         }
+        ProcessControlBlock* grown = realloc(table->pcbs, sizeof(ProcessControlBlock) * (size_t)table->capacity * 2);
+        if (!grown){
+            printf("Memory Allocation Failed!\n");
+            return NULL;
+        }
+        table->pcbs = grown;
+        table->capacity *= 2;
+    }
+    if (2 * (table->count + 1) > table->slotCount && !growPidSlots(table)){
+        printf("Memory Allocation Failed!\n");
+        return NULL;
     }
-    free(hashMap);
+
+    ProcessControlBlock* pcb = &table->pcbs[table->count];
+    memset(pcb, 0, sizeof(ProcessControlBlock));
+    pcb->processId = processId;
+    pcb->cpu = -1;
+    pcb->firstRun = -1;
+    pcb->state = READY;
+
+    table->slots[findPidSlot(table, processId)] = table->count + 1;
+    table->count++;
+    return pcb;
 }
 
+void freeProcessTable(ProcessTable* table) {
+    if (!table){
+        return;
+    }
+    free(table->pcbs);
+    free(table->slots);
+    free(table->ioPhases);
+    free(table);
+}
 
-Queue* createQueue() {
-    Queue* queue = malloc(sizeof(Queue));
-    if (!queue){
+ProcessTable* cloneProcessTable(const ProcessTable* source) {
+    ProcessTable* table = calloc(1, sizeof(ProcessTable));
+    if (!table){
         printf("Memory Allocation Failed!\n");
         return NULL;
     }
-    queue->front = queue->rear = NULL;
-    return queue;
-}
 
-Node* createQueueNode(int processId) {
-    Node* newNode = malloc(sizeof(Node));
-    if (!newNode){
+    table->count = table->capacity = source->count;
+    table->slotCount = source->slotCount;
+    table->ioPhaseCount = table->ioPhaseCapacity = source->ioPhaseCount;
+    table->pcbs = malloc(sizeof(ProcessControlBlock) * (source->count > 0 ? source->count : 1));
+    table->slots = malloc(sizeof(int) * source->slotCount);
+    table->ioPhases = malloc(sizeof(IoPhase) * (source->ioPhaseCount > 0 ? source->ioPhaseCount : 1));
+    if (!table->pcbs || !table->slots || !table->ioPhases){
+        printf("Memory Allocation Failed!\n");
+        freeProcessTable(table);
         return NULL;
     }
 
-    newNode->processId = processId;
-    newNode->next = NULL;
+    memcpy(table->pcbs, source->pcbs, sizeof(ProcessControlBlock) * source->count);
+    memcpy(table->slots, source->slots, sizeof(int) * source->slotCount);
+    memcpy(table->ioPhases, source->ioPhases, sizeof(IoPhase) * source->ioPhaseCount);
+    return table;
+}
 
-    return newNode;
+void loadNextIoPhase(ProcessTable* table, ProcessControlBlock* pcb) {
+    pcb->ioPending = pcb->ioPhase < pcb->ioPhaseEnd;
+    pcb->ioStartTime = pcb->ioPending ? (int)table->ioPhases[pcb->ioPhase].start : -1;
 }
 
-void enqueue(Queue* queue, int processId) {
-    if (!queue){
-        return;
+// Phases are sorted by start and ones at the same offset merged. A phase at
+// offset 0 or at/after the end of the burst never happens but still counts
+// towards the reported I/O total.
+bool setIoPhases(ProcessTable* table, ProcessControlBlock* pcb, IoPhase* phases, int phaseCount) {
+    for (int index = 1; index < phaseCount; index++){
+        IoPhase phase = phases[index];
+        int slot = index;
+        while (slot > 0 && phases[slot - 1].start > phase.start){
+            phases[slot] = phases[slot - 1];
+            slot--;
+        }
+        phases[slot] = phase;
     }
 
-    Node* newNode = createQueueNode(processId);
-    if (!newNode) {
-        printf("ERROR: Failed to allocate queue node\n");
-        return;  
+    if (table->ioPhaseCount + phaseCount > table->ioPhaseCapacity){
+        int capacity = table->ioPhaseCapacity ? table->ioPhaseCapacity : 16;
+        while (capacity < table->ioPhaseCount + phaseCount){
+            capacity *= 2;
+        }
+        IoPhase* grown = realloc(table->ioPhases, sizeof(IoPhase) * capacity);
+        if (!grown){
+            printf("Memory Allocation Failed!\n");
+            return false;
+        }
+        table->ioPhases = grown;
+        table->ioPhaseCapacity = capacity;
     }
-    if (!queue->front){
-        queue->front = queue->rear = newNode;
-        return;
+
+    pcb->ioDuration = 0;
+    pcb->ioPhase = table->ioPhaseCount;
+    for (int index = 0; index < phaseCount; index++){
+        pcb->ioDuration += phases[index].duration;
+        if (phases[index].start == 0 || phases[index].start >= pcb->burstTime){
+            continue;
+        }
+        if (table->ioPhaseCount > pcb->ioPhase && table->ioPhases[table->ioPhaseCount - 1].start == phases[index].start){
+            table->ioPhases[table->ioPhaseCount - 1].duration += phases[index].duration;
+        }else{
+            table->ioPhases[table->ioPhaseCount++] = phases[index];
+        }
     }
+    pcb->ioPhaseEnd = table->ioPhaseCount;
 
-    queue->rear->next = newNode;
-    queue->rear = newNode;
+    loadNextIoPhase(table, pcb);
+    return true;
 }
 
-int dequeue(Queue* queue) {
-    if (!queue || !queue->front){
-        printf("Empty Queue\n");
-        return -1;
-    }
-
-    Node* toDelete  = queue->front;
-    int processId = toDelete->processId;
 
-    if (queue->front == queue->rear){
-        queue->rear = NULL;
+void enqueue(Queue* queue, ProcessControlBlock* pcb) {
+    pcb->queueNext = NULL;
+    pcb->queuePrev = queue->rear;
+    if (queue->rear){
+        queue->rear->queueNext = pcb;
+    }else{
+        queue->front = pcb;
     }
-    queue->front = queue->front->next;
-    free(toDelete);
-
-    return processId;
+    queue->rear = pcb;
 }
 
-bool removeFromQueue(Queue* queue, int processId) {
-    if (!queue || !queue->front){
+bool unlinkFromQueue(Queue* queue, ProcessControlBlock* pcb) {
+    if (!pcb->queuePrev && queue->front != pcb){
         return false;
     }
 
-    Node* curr = queue->front;
-    Node* prev = NULL;
-
-    while (curr) {
-        if (curr->processId == processId){
-            if (!prev){
-                queue->front = curr->next;
-            }else{
-                prev->next = curr->next;
-            }
-
-            if (queue->rear == curr){
-                queue->rear = prev;
-            }
-
-            free(curr);
-            return true;
-        }
-        prev = curr;
-        curr = curr->next;
+    if (pcb->queuePrev){
+        pcb->queuePrev->queueNext = pcb->queueNext;
+    }else{
+        queue->front = pcb->queueNext;
     }
 
-    return false;
-}
-
+    if (pcb->queueNext){
+        pcb->queueNext->queuePrev = pcb->queuePrev;
+    }else{
+        queue->rear = pcb->queuePrev;
+    }
 
-bool isQueueEmpty(Queue* queue) {
-    return !queue || !queue->front;
+    pcb->queueNext = pcb->queuePrev = NULL;
+    return true;
 }
 
-void freeQueue(Queue* queue) {
-    if (!queue){
-        return;
-    }
-
-    while (queue->front){
-        dequeue(queue);
+ProcessControlBlock* dequeue(Queue* queue) {
+    ProcessControlBlock* pcb = queue->front;
+    if (pcb){
+        unlinkFromQueue(queue, pcb);
     }
+    return pcb;
+}
 
-    free(queue);
+bool isQueueEmpty(const Queue* queue) {
+    return !queue->front;
 }
 
 KillEvent* createKillEvents(int killCount) {
@@ -254,293 +566,1726 @@ KillEvent* createKillEvents(int killCount) {
     return kills;
 }
 
-void moveToWaiting(ProcessControlBlock* pcb, int processId, Queue* waitingQueue) {
-    pcb->state = WAITING;
-    pcb->ioRemaining = pcb->ioDuration;
-    pcb->ioStartedThisTick = true;
-    enqueue(waitingQueue, processId);
+int compareKillTime(const void* left, const void* right) {
+    const KillEvent* a = left;
+    const KillEvent* b = right;
+    return (a->time > b->time) - (a->time < b->time);
 }
 
-void moveToTerminated(ProcessControlBlock* pcb, int processId, int clock, Queue* terminatedQueue) {
-    pcb->turnAroundTime = clock;
-    pcb->waitingTime = pcb->turnAroundTime - pcb->burstTime;
-    pcb->state = TERMINATED;
-    enqueue(terminatedQueue, processId);
-}
 
-void killProcess(ProcessControlBlock* pcb, int processId, int clock, Queue* terminatedQueue) {
-    pcb->turnAroundTime = -1;
-    pcb->waitingTime = -1;
-    pcb->state = KILLED;
-    enqueue(terminatedQueue, processId);
+MinHeap* createMinHeap() {
+    MinHeap* heap = malloc(sizeof(MinHeap));
+    if (!heap){
+        printf("Memory Allocation Failed!\n");
+        return NULL;
+    }
+
+    heap->size = 0;
+    heap->capacity = 16;
+    heap->indexed = false;
+    heap->items = malloc(heap->capacity * sizeof(HeapItem));
+    if (!heap->items){
+        printf("Memory Allocation Failed!\n");
+        free(heap);
+        return NULL;
+    }
+
+    return heap;
 }
 
-void updateWaitingProcesses(Queue* waitingQueue, Queue* readyQueue, HashMap* hashMap) {
-    Node* curr = waitingQueue->front;
-    Node* prev = NULL;
+bool heapItemBefore(const HeapItem* a, const HeapItem* b) {
+    if (a->key != b->key){
+        return a->key < b->key;
+    }
+    if (a->tag != b->tag){
+        return a->tag < b->tag;
+    }
+    return a->seq < b->seq;
+}
 
-    while (curr){
-        int processId = curr->processId;
-        ProcessControlBlock* pcb = getFromHashMap(hashMap, processId);
+void placeHeapItem(MinHeap* heap, int index, HeapItem item) {
+    heap->items[index] = item;
+    if (heap->indexed && item.pcb){
+        item.pcb->heapIndex = index;
+    }
+}
 
-        if (!pcb){
-            prev = curr;
-            curr = curr->next;
-            continue;
+void siftUp(MinHeap* heap, int index) {
+    HeapItem item = heap->items[index];
+    while (index > 0){
+        int parent = (index - 1) / 2;
+        if (!heapItemBefore(&item, &heap->items[parent])){
+            break;
         }
+        placeHeapItem(heap, index, heap->items[parent]);
+        index = parent;
+    }
+    placeHeapItem(heap, index, item);
+}
 
-        if (pcb->ioStartedThisTick){
-            pcb->ioStartedThisTick = false;
-            prev = curr;
-            curr = curr->next;
-            continue;
+void siftDown(MinHeap* heap, int index) {
+    HeapItem item = heap->items[index];
+    while (true){
+        int child = 2 * index + 1;
+        if (child >= heap->size){
+            break;
+        }
+        if (child + 1 < heap->size && heapItemBefore(&heap->items[child + 1], &heap->items[child])){
+            child++;
+        }
+        if (!heapItemBefore(&heap->items[child], &item)){
+            break;
         }
+        placeHeapItem(heap, index, heap->items[child]);
+        index = child;
+    }
+    placeHeapItem(heap, index, item);
+}
 
-        pcb->ioRemaining--;
+bool pushHeap(MinHeap* heap, HeapItem item) {
+    if (heap->size == heap->capacity){
+        HeapItem* grown = realloc(heap->items, 2 * heap->capacity * sizeof(HeapItem));
+        if (!grown){
+            printf("Memory Allocation Failed!\n");
+            return false;
+        }
+        heap->items = grown;
+        heap->capacity *= 2;
+    }
 
-        if (pcb->ioRemaining <= 0){
-            Node* toRemove = curr;
+    heap->items[heap->size] = item;
+    siftUp(heap, heap->size++);
+    return true;
+}
 
-            if (!prev){
-                waitingQueue->front = curr->next;
-            }else{
-                prev->next = curr->next;
-            }
+HeapItem popHeap(MinHeap* heap) {
+    HeapItem top = heap->items[0];
+    heap->items[0] = heap->items[--heap->size];
+    if (heap->size > 0){
+        siftDown(heap, 0);
+    }
+    return top;
+}
 
-            if (waitingQueue->rear == curr){
-                waitingQueue->rear = prev;
-            }
+void removeHeapAt(MinHeap* heap, int index) {
+    heap->items[index] = heap->items[--heap->size];
+    if (index < heap->size){
+        siftDown(heap, index);
+        siftUp(heap, index);
+    }
+}
 
-            curr = curr->next;
-            free(toRemove);
+void freeMinHeap(MinHeap* heap) {
+    if (!heap){
+        return;
+    }
+    free(heap->items);
+    free(heap);
+}
 
-            pcb->state = READY;
-            enqueue(readyQueue, processId);
-        }else{
-            prev = curr;
-            curr = curr->next;
-        }
+// CPU time the process will use before it next blocks for I/O or finishes.
+unsigned int nextBurstLength(const ProcessControlBlock* pcb) {
+    if (pcb->ioPending){
+        return pcb->ioStartTime - pcb->cpuExecuted;
     }
+    return pcb->remBurstTime;
 }
 
-void applyKillEvents(KillEvent* kills, int killCount, int clock, HashMap* hashMap, Queue* readyQueue, Queue* waitingQueue, Queue* terminatedQueue,
-int* runningProcessId,  int* terminatedCount) {
-    for (int index = 0; index < killCount; index++){
-        if (kills[index].time != clock){
-            continue;
-        }
 
-        int processId = kills[index].processId;
-        ProcessControlBlock* pcb = getFromHashMap(hashMap, processId);
-        if (!pcb || pcb->state == TERMINATED || pcb->state == KILLED) {
-            continue;
-        }
+// FCFS and Round Robin share one FIFO queue (level 0).
+void fifoArrival(Policy* policy, ProcessControlBlock* pcb, int processId, long long clock) {
+    enqueue(&policy->levels[0], pcb);
+}
 
-        if (*runningProcessId == processId){
-            killProcess(pcb, processId, clock, terminatedQueue);
-            (*terminatedCount)++;
-            *runningProcessId = -1;
-            continue;
-        }
+ProcessControlBlock* fifoPickNext(Policy* policy, long long clock) {
+    return dequeue(&policy->levels[0]);
+}
 
-        if (removeFromQueue(readyQueue, processId) || removeFromQueue(waitingQueue, processId)){
-            killProcess(pcb, processId, clock, terminatedQueue);
-            (*terminatedCount)++;
-        }
+void fifoPreempt(Policy* policy, ProcessControlBlock* pcb, int processId, long long clock, bool quantumExpired) {
+    fifoArrival(policy, pcb, processId, clock);
+}
 
-    }
+bool fifoRemove(Policy* policy, ProcessControlBlock* pcb, int processId) {
+    return unlinkFromQueue(&policy->levels[0], pcb);
 }
 
-void printResults(HashMap* hashMap) {
-    printf("\n%-8s%-15s%-10s%-10s%-15s%-12s%-10s\n","PID", "Name", "CPU", "IO", "Turnaround", "Waiting", "Status");
-    printf("--------------------------------------------------------------------------------\n");
-    
-    for (int index = 0; index < HASH_SIZE; index++) {
-        HashNode* node = hashMap->buckets[index];
-        while (node) 
-        {
-            ProcessControlBlock* pcb = node->value;
-            const char* status = (pcb->state == KILLED) ? "KILLED" : "OK";
-            
-            printf("%-8d%-15s%-10d%-10d%-15d%-12d%-10s\n",
-                   node->key, pcb->name, pcb->burstTime, pcb->ioDuration, pcb->turnAroundTime, pcb->waitingTime, status);
-            
-            node = node->next;
-        }
-    }
-}
-
-void fcfsScheduler(HashMap* hashMap, Queue* readyQueue, int totalProcesses, KillEvent* kills, int killCount) {
-    Queue* waitingQueue = createQueue();
-    Queue* terminatedQueue = createQueue();
-
-    int clock = 0;
-    int runningProcessId = -1;
-    int terminatedProcesses = 0;
-
-    while (terminatedProcesses < totalProcesses){
-        applyKillEvents(kills, killCount, clock, hashMap, readyQueue, waitingQueue, terminatedQueue, &runningProcessId, &terminatedProcesses);
-
-        if (runningProcessId == -1 && !isQueueEmpty(readyQueue)){
-            runningProcessId = dequeue(readyQueue);
-            ProcessControlBlock* pcb = getFromHashMap(hashMap, runningProcessId);
-            if (pcb){
-                pcb->state = RUNNING;
-            }
-        }
+unsigned int noTimeSlice(Policy* policy, ProcessControlBlock* pcb) {
+    return 0;
+}
 
-        if (runningProcessId != -1){
-            ProcessControlBlock* pcb = getFromHashMap(hashMap, runningProcessId);
+unsigned int fixedTimeSlice(Policy* policy, ProcessControlBlock* pcb) {
+    return policy->config.quantum;
+}
 
-            if (pcb){
-                pcb->cpuExecuted++;
-                pcb->remBurstTime--;
 
-                if (pcb->ioStartTime >= 0 && pcb->cpuExecuted == pcb->ioStartTime && pcb->remBurstTime > 0){
-                    moveToWaiting(pcb, runningProcessId, waitingQueue);
-                    runningProcessId = -1;
-                }else if (pcb->remBurstTime <= 0){
-                    moveToTerminated(pcb, runningProcessId, clock + 1, terminatedQueue);
-                    terminatedProcesses++;
-                    runningProcessId = -1;
-                }
-            }
+// SJF, SRTF and Priority keep ready processes in a min-heap; equal keys
+// leave in arrival order.
+long long readyKey(Policy* policy, ProcessControlBlock* pcb, long long clock) {
+    if (policy->config.kind == POLICY_PRIORITY){
+        // Waiting agingInterval ticks is worth one priority level, so the
+        // effective priority at any later time orders the same as this key.
+        if (policy->config.agingInterval == 0){
+            return pcb->priority;
         }
+        return (long long)pcb->priority * policy->config.agingInterval + clock;
+    }
+    return nextBurstLength(pcb);
+}
 
-        updateWaitingProcesses(waitingQueue, readyQueue, hashMap);
+void heapArrival(Policy* policy, ProcessControlBlock* pcb, int processId, long long clock) {
+    HeapItem item = {readyKey(policy, pcb, clock), 0, ++policy->seq, processId, pcb};
+    pushHeap(policy->heap, item);
+}
 
-        clock++;
-    }
+ProcessControlBlock* heapPickNext(Policy* policy, long long clock) {
+    return policy->heap->size == 0 ? NULL : popHeap(policy->heap).pcb;
+}
 
-    printResults(hashMap);
+void heapPreempt(Policy* policy, ProcessControlBlock* pcb, int processId, long long clock, bool quantumExpired) {
+    heapArrival(policy, pcb, processId, clock);
+}
 
-    freeQueue(waitingQueue);
-    freeQueue(terminatedQueue);
+bool heapRemove(Policy* policy, ProcessControlBlock* pcb, int processId) {
+    removeHeapAt(policy->heap, pcb->heapIndex);
+    return true;
 }
 
-ProcessControlBlock* createProcess() {
-    ProcessControlBlock* pcb = malloc(sizeof(ProcessControlBlock));
-    if (!pcb){
-        printf("Memory Allocation Failed!\n");
-        return NULL;
-    }
+bool srtfShouldPreempt(Policy* policy, ProcessControlBlock* running, ProcessControlBlock* arriving, long long clock) {
+    long long runningLeft = (long long)nextBurstLength(running) - (clock - running->runStart);
+    return nextBurstLength(arriving) < runningLeft;
+}
 
-    pcb->cpuExecuted = 0;
-    pcb->waitingTime = 0;
-    pcb->turnAroundTime = 0;
-    pcb->ioRemaining = 0;
-    pcb->ioStartedThisTick = false;
-    pcb->state = READY;
 
-    return pcb;
+// MLFQ: one FIFO per level, quantum doubling per level. A process that
+// uses its whole quantum drops a level; every boostInterval all processes
+// return to the top level.
+void mlfqArrival(Policy* policy, ProcessControlBlock* pcb, int processId, long long clock) {
+    enqueue(&policy->levels[pcb->level], pcb);
 }
 
-void readProcessInput(HashMap* hashMap, Queue* readyQueue, int* totalProcesses) {
+ProcessControlBlock* mlfqPickNext(Policy* policy, long long clock) {
+    for (int level = 0; level < policy->levelCount; level++){
+        if (!isQueueEmpty(&policy->levels[level])){
+            return dequeue(&policy->levels[level]);
+        }
+    }
+    return NULL;
+}
 
-    printf("Enter number of processes: ");
-    char line[256];
-    if (!fgets(line, sizeof(line), stdin)) {
-        printf("Error reading number of processes!\n");
-        return;
+void mlfqPreempt(Policy* policy, ProcessControlBlock* pcb, int processId, long long clock, bool quantumExpired) {
+    if (quantumExpired && pcb->level < policy->levelCount - 1){
+        pcb->level++;
     }
-    *totalProcesses = atoi(line);
+    mlfqArrival(policy, pcb, processId, clock);
+}
 
-    printf("name  pid  burst  ioStart  ioDuration\n");
-    printf("(Use '-' for no I/O)\n\n");
+bool mlfqRemove(Policy* policy, ProcessControlBlock* pcb, int processId) {
+    return unlinkFromQueue(&policy->levels[pcb->level], pcb);
+}
 
-    for (int i = 0; i < *totalProcesses; i++) {
+unsigned int mlfqTimeSlice(Policy* policy, ProcessControlBlock* pcb) {
+    return policy->config.quantum << pcb->level;
+}
 
-        printf("Process %d: ", i + 1);
+bool mlfqShouldPreempt(Policy* policy, ProcessControlBlock* running, ProcessControlBlock* arriving, long long clock) {
+    return arriving->level < running->level;
+}
 
-        char name[SIZE + 1];
-        char ioStartStr[20], ioDurStr[20];
-        int pid, burst;
+void mlfqBoost(Policy* policy, ProcessControlBlock* running, long long clock) {
+    if (running){
+        running->level = 0;
+    }
+    for (int level = 1; level < policy->levelCount; level++){
+        ProcessControlBlock* pcb;
+        while ((pcb = dequeue(&policy->levels[level]))){
+            pcb->level = 0;
+            enqueue(&policy->levels[0], pcb);
+        }
+    }
+}
 
+const PolicyOps policyTable[] = {
+    [POLICY_FCFS] = {"fcfs", fifoArrival, fifoPickNext, fifoPreempt, fifoRemove, noTimeSlice, NULL, NULL},
+    [POLICY_SJF] = {"sjf", heapArrival, heapPickNext, heapPreempt, heapRemove, noTimeSlice, NULL, NULL},
+    [POLICY_SRTF] = {"srtf", heapArrival, heapPickNext, heapPreempt, heapRemove, noTimeSlice, srtfShouldPreempt, NULL},
+    [POLICY_RR] = {"rr", fifoArrival, fifoPickNext, fifoPreempt, fifoRemove, fixedTimeSlice, NULL, NULL},
+    [POLICY_PRIORITY] = {"priority", heapArrival, heapPickNext, heapPreempt, heapRemove, noTimeSlice, NULL, NULL},
+    [POLICY_MLFQ] = {"mlfq", mlfqArrival, mlfqPickNext, mlfqPreempt, mlfqRemove, mlfqTimeSlice, mlfqShouldPreempt, mlfqBoost},
+};
+
+void freePolicy(Policy* policy) {
+    if (!policy){
+        return;
+    }
+    freeMinHeap(policy->heap);
+    free(policy);
+}
 
-        if (!fgets(line, sizeof(line), stdin)) {
-            printf("Error reading process input!\n");
-            return;
-        }
+Policy* createPolicy(const SchedulerConfig* config) {
+    Policy* policy = calloc(1, sizeof(Policy));
+    if (!policy){
+        printf("Memory Allocation Failed!\n");
+        return NULL;
+    }
 
-        int fields = sscanf(
-            line,
-            "%100s %d %d %19s %19s",
-            name, &pid, &burst, ioStartStr, ioDurStr
-        );
+    policy->ops = &policyTable[config->kind];
+    policy->config = *config;
+    policy->levelCount = (config->kind == POLICY_MLFQ) ? config->mlfqLevels : 1;
 
-        
-        if (fields < 5) {
-            printf("Invalid input format! Please re-enter.\n");
-            i--;    
-            continue;
+    if (config->kind == POLICY_SJF || config->kind == POLICY_SRTF || config->kind == POLICY_PRIORITY){
+        policy->heap = createMinHeap();
+        if (!policy->heap){
+            freePolicy(policy);
+            return NULL;
         }
+        policy->heap->indexed = true;
+    }
 
-       
-        ProcessControlBlock* pcb = createProcess();
+    return policy;
+}
 
-        strcpy(pcb->name, name);
 
-        pcb->burstTime = burst;
-        pcb->remBurstTime = burst;
+// A PCB has at most one pending CPU or I/O event; the event heap tracks
+// its position so preemption and kills pull it straight out.
+void scheduleEvent(Simulation* sim, EventType type, long long time, int processId, ProcessControlBlock* pcb) {
+    HeapItem event = {time, type, ++sim->seq, processId, pcb};
+    pushHeap(sim->events, event);
+}
 
-        
-        if (strcmp(ioStartStr, "-") == 0 || strcmp(ioDurStr, "-") == 0) {
-            pcb->ioStartTime = -1;
-            pcb->ioDuration = 0;
-        }
-        else {
-            pcb->ioStartTime = atoi(ioStartStr);
-            pcb->ioDuration = atoi(ioDurStr);
-
-            
-            if (pcb->ioStartTime < 0 || pcb->ioDuration <= 0) {
-                pcb->ioStartTime = -1;
-                pcb->ioDuration = 0;
-            }
-        }
+void moveToTerminated(ProcessControlBlock* pcb, long long clock) {
+    pcb->turnAroundTime = clock;
+    pcb->waitingTime = pcb->turnAroundTime - pcb->burstTime;
+    pcb->state = TERMINATED;
+}
+
+void killProcess(ProcessControlBlock* pcb) {
+    pcb->turnAroundTime = -1;
+    pcb->waitingTime = -1;
+    pcb->state = KILLED;
+}
+
+void recordSlice(Simulation* sim, SliceKind kind, int cpu, ProcessControlBlock* pcb, long long start) {
+    Timeline* timeline = sim->timeline;
+    if (!timeline || start == sim->clock){
+        return;
+    }
 
-        insertIntoHashMap(hashMap, pid, pcb);
-        enqueue(readyQueue, pid);
+    if (timeline->count == timeline->capacity){
+        int capacity = timeline->capacity ? timeline->capacity * 2 : 1024;
+        TimelineSlice* grown = realloc(timeline->slices, sizeof(TimelineSlice) * capacity);
+        if (!grown){
+            printf("Memory Allocation Failed!\n");
+            sim->timeline = NULL;
+            return;
+        }
+        timeline->slices = grown;
+        timeline->capacity = capacity;
     }
+    TimelineSlice slice = {start, sim->clock, pcb->processId, (short)cpu, (short)kind};
+    timeline->slices[timeline->count++] = slice;
 }
 
+void chargeCpuTime(Simulation* sim, Cpu* cpu, ProcessControlBlock* pcb) {
+    unsigned int ran = (unsigned int)(sim->clock - pcb->runStart);
+    pcb->cpuExecuted += ran;
+    pcb->remBurstTime -= ran;
+    cpu->stats.busyTime += ran;
+    recordSlice(sim, SLICE_RUN, (int)(cpu - sim->cpus), pcb, pcb->runStart);
+}
 
-void readKillEvents(KillEvent** kills, int* killCount) {
+int cpuLoad(const Cpu* cpu) {
+    return cpu->readyCount + (cpu->runningProcessId != -1);
+}
 
-    printf("\nEnter number of KILL events: ");
-    scanf("%d", killCount);
+// Picks the run queue a newly ready process joins. Push migration sends it
+// to the least loaded CPU, staying put on a tie; affinity and stealing keep
+// it on the CPU it last ran on and only place first arrivals.
+int chooseCpu(Simulation* sim, ProcessControlBlock* pcb) {
+    if (pcb->cpu != -1 && sim->balance != BALANCE_PUSH){
+        return pcb->cpu;
+    }
 
-    if (*killCount <= 0) {
+    int best = (pcb->cpu != -1) ? pcb->cpu : 0;
+    for (int index = 0; index < sim->cpuCount; index++){
+        if (cpuLoad(&sim->cpus[index]) < cpuLoad(&sim->cpus[best])){
+            best = index;
+        }
+    }
+    return best;
+}
+
+void preemptRunning(Simulation* sim, Cpu* cpu, bool quantumExpired) {
+    int processId = cpu->runningProcessId;
+    ProcessControlBlock* pcb = lookupProcess(sim->table, processId);
+    cpu->runningProcessId = -1;
+    if (!pcb){
         return;
     }
 
-    *kills = createKillEvents(*killCount);
-    printf("pid time\n\n");
+    chargeCpuTime(sim, cpu, pcb);
+    removeHeapAt(sim->events, pcb->heapIndex);
+    pcb->state = READY;
+    cpu->policy->ops->onPreempt(cpu->policy, pcb, processId, sim->clock, quantumExpired);
+    cpu->readyCount++;
+}
 
-    for (int i = 0; i < *killCount; i++) {
-        scanf("%d %d", &(*kills)[i].processId, &(*kills)[i].time);
+void makeReady(Simulation* sim, ProcessControlBlock* pcb, int processId) {
+    int target = chooseCpu(sim, pcb);
+    if (pcb->cpu != -1 && pcb->cpu != target){
+        sim->migrations++;
     }
-}
+    pcb->cpu = target;
 
-int main() {
-    HashMap* hashMap = createHashMap();
-    Queue* readyQueue = createQueue();
+    Cpu* cpu = &sim->cpus[target];
+    const PolicyOps* ops = cpu->policy->ops;
+    pcb->state = READY;
+    ops->onArrival(cpu->policy, pcb, processId, sim->clock);
+    cpu->readyCount++;
 
-    int totalProcesses = 0;
-    readProcessInput(hashMap, readyQueue, &totalProcesses);
+    if (cpu->runningProcessId != -1 && ops->shouldPreempt){
+        ProcessControlBlock* running = lookupProcess(sim->table, cpu->runningProcessId);
+        if (running && ops->shouldPreempt(cpu->policy, running, pcb, sim->clock)){
+            preemptRunning(sim, cpu, false);
+        }
+    }
+}
 
-    KillEvent* kills = NULL;
-    int killCount = 0;
-    readKillEvents(&kills, &killCount);
+// Runs the chosen process until it blocks for I/O, finishes, or uses up
+// its time slice, and schedules the event for that moment. With stealing
+// enabled an idle CPU takes the next process from the longest run queue.
+void dispatchNext(Simulation* sim, int cpuIndex, bool steal) {
+    Cpu* cpu = &sim->cpus[cpuIndex];
+    Cpu* source = cpu;
+    if (steal){
+        source = NULL;
+        for (int index = 0; index < sim->cpuCount; index++){
+            if (sim->cpus[index].readyCount > 0 && (!source || sim->cpus[index].readyCount > source->readyCount)){
+                source = &sim->cpus[index];
+            }
+        }
+        if (!source){
+            return;
+        }
+    }
+
+    ProcessControlBlock* pcb = source->policy->ops->pickNext(source->policy, sim->clock);
+    if (!pcb){
+        return;
+    }
+    source->readyCount--;
+    int processId = pcb->processId;
+    if (source != cpu){
+        cpu->stats.steals++;
+        sim->migrations++;
+    }
 
-    fcfsScheduler(hashMap, readyQueue, totalProcesses, kills, killCount);
+    pcb->cpu = cpuIndex;
+    cpu->runningProcessId = processId;
+    cpu->stats.dispatches++;
+    if (cpu->lastProcessId != -1 && cpu->lastProcessId != processId){
+        cpu->stats.contextSwitches++;
+    }
+    cpu->lastProcessId = processId;
+    if (pcb->firstRun == -1){
+        pcb->firstRun = sim->clock;
+    }
+    pcb->state = RUNNING;
+    pcb->runStart = sim->clock;
 
-    if (kills)
-    {
-        free(kills);
+    unsigned int slice = nextBurstLength(pcb);
+    unsigned int quantum = cpu->policy->ops->timeSlice(cpu->policy, pcb);
+    if (quantum > 0 && quantum < slice){
+        slice = quantum;
     }
+    scheduleEvent(sim, CPU_DONE, sim->clock + slice, processId, pcb);
+}
 
-    freeQueue(readyQueue);
-    freeHashMap(hashMap);
-    return 0;
-}
\ No newline at end of file
+void dispatchIdleCpus(Simulation* sim) {
+    for (int index = 0; index < sim->cpuCount; index++){
+        if (sim->cpus[index].runningProcessId == -1){
+            dispatchNext(sim, index, false);
+        }
+    }
+    if (sim->balance != BALANCE_STEAL){
+        return;
+    }
+    for (int index = 0; index < sim->cpuCount; index++){
+        if (sim->cpus[index].runningProcessId == -1){
+            dispatchNext(sim, index, true);
+        }
+    }
+}
+
+void handleCpuDone(Simulation* sim, ProcessControlBlock* pcb, int processId) {
+    Cpu* cpu = &sim->cpus[pcb->cpu];
+    chargeCpuTime(sim, cpu, pcb);
+    cpu->runningProcessId = -1;
+
+    if (pcb->remBurstTime == 0){
+        moveToTerminated(pcb, sim->clock);
+        sim->terminatedCount++;
+    }else if (pcb->ioPending && pcb->cpuExecuted == (unsigned int)pcb->ioStartTime){
+        unsigned int duration = sim->table->ioPhases[pcb->ioPhase++].duration;
+        loadNextIoPhase(sim->table, pcb);
+        pcb->state = WAITING;
+        pcb->ioRemaining = duration;
+        pcb->ioSince = sim->clock;
+        scheduleEvent(sim, IO_DONE, sim->clock + duration, processId, pcb);
+    }else{
+        pcb->state = READY;
+        cpu->policy->ops->onPreempt(cpu->policy, pcb, processId, sim->clock, true);
+        cpu->readyCount++;
+    }
+}
+
+void handleKill(Simulation* sim, ProcessControlBlock* pcb, int processId) {
+    if (!pcb || pcb->state == TERMINATED || pcb->state == KILLED) {
+        return;
+    }
+
+    if (pcb->state == RUNNING){
+        Cpu* cpu = &sim->cpus[pcb->cpu];
+        chargeCpuTime(sim, cpu, pcb);
+        removeHeapAt(sim->events, pcb->heapIndex);
+        cpu->runningProcessId = -1;
+    }else if (pcb->state == WAITING){
+        removeHeapAt(sim->events, pcb->heapIndex);
+        recordSlice(sim, SLICE_IO, -1, pcb, pcb->ioSince);
+    }else if (pcb->state == READY){
+        Cpu* cpu = &sim->cpus[pcb->cpu];
+        if (cpu->policy->ops->remove(cpu->policy, pcb, processId)){
+            cpu->readyCount--;
+        }
+    }
+
+    killProcess(pcb);
+    sim->terminatedCount++;
+}
+
+// Kills are sorted by time up front, so only the ones due now are looked at.
+void applyDueKills(Simulation* sim) {
+    while (sim->killCursor < sim->killCount && sim->kills[sim->killCursor].time == sim->clock){
+        int processId = sim->kills[sim->killCursor++].processId;
+        handleKill(sim, lookupProcess(sim->table, processId), processId);
+    }
+}
+
+long long nextEventTime(Simulation* sim) {
+    long long next = -1;
+    if (sim->events->size > 0){
+        next = sim->events->items[0].key;
+    }
+    if (sim->killCursor < sim->killCount && (next == -1 || sim->kills[sim->killCursor].time < next)){
+        next = sim->kills[sim->killCursor].time;
+    }
+    return next;
+}
+
+void handleEvent(Simulation* sim, HeapItem event) {
+    if (event.tag == TIMER){
+        for (int index = 0; index < sim->cpuCount; index++){
+            Cpu* cpu = &sim->cpus[index];
+            ProcessControlBlock* running = (cpu->runningProcessId == -1) ? NULL : lookupProcess(sim->table, cpu->runningProcessId);
+            cpu->policy->ops->onTick(cpu->policy, running, sim->clock);
+        }
+        scheduleEvent(sim, TIMER, sim->clock + sim->cpus[0].policy->config.boostInterval, -1, NULL);
+        return;
+    }
+
+    if (event.tag == CPU_DONE){
+        handleCpuDone(sim, event.pcb, event.processId);
+    }else{
+        event.pcb->ioRemaining = 0;
+        recordSlice(sim, SLICE_IO, -1, event.pcb, event.pcb->ioSince);
+        makeReady(sim, event.pcb, event.processId);
+    }
+}
+
+int compareProcessId(const void* left, const void* right) {
+    int a = (*(ProcessControlBlock* const*)left)->processId;
+    int b = (*(ProcessControlBlock* const*)right)->processId;
+    return (a > b) - (a < b);
+}
+
+ProcessControlBlock** sortByProcessId(ProcessTable* table) {
+    ProcessControlBlock** order = malloc(sizeof(ProcessControlBlock*) * (table->count > 0 ? table->count : 1));
+    if (!order){
+        printf("Memory Allocation Failed!\n");
+        return NULL;
+    }
+    for (int index = 0; index < table->count; index++){
+        order[index] = &table->pcbs[index];
+    }
+    qsort(order, table->count, sizeof(ProcessControlBlock*), compareProcessId);
+    return order;
+}
+
+void printResults(ProcessTable* table) {
+    printf("\n%-8s%-15s%-10s%-10s%-15s%-12s%-10s\n","PID", "Name", "CPU", "IO", "Turnaround", "Waiting", "Status");
+    printf("--------------------------------------------------------------------------------\n");
+
+    ProcessControlBlock** order = sortByProcessId(table);
+    if (!order){
+        return;
+    }
+
+    for (int index = 0; index < table->count; index++){
+        ProcessControlBlock* pcb = order[index];
+        const char* status = (pcb->state == KILLED) ? "KILLED" : "OK";
+
+        printf("%-8d%-15s%-10d%-10d%-15lld%-12lld%-10s\n",
+               pcb->processId, pcb->name, pcb->burstTime, pcb->ioDuration, pcb->turnAroundTime, pcb->waitingTime, status);
+    }
+    free(order);
+}
+
+void printCpuStats(const SimulationReport* report) {
+    printf("\n%-8s%-15s%-15s%-10s%-12s%-10s%-10s\n", "CPU", "Busy", "Idle", "Util%", "Dispatches", "Steals", "Switches");
+    printf("--------------------------------------------------------------------------------\n");
+
+    for (int index = 0; index < report->cpuCount; index++){
+        const CpuStats* cpu = &report->cpus[index];
+        double utilization = (report->makespan > 0) ? 100.0 * cpu->busyTime / report->makespan : 0.0;
+        printf("%-8d%-15lld%-15lld%-10.1f%-12lld%-10lld%-10lld\n",
+               index, cpu->busyTime, report->makespan - cpu->busyTime, utilization, cpu->dispatches, cpu->steals,
+               cpu->contextSwitches);
+    }
+    printf("Migrations: %lld\n", report->migrations);
+}
+
+void freeCpus(Cpu* cpus, int cpuCount) {
+    if (!cpus){
+        return;
+    }
+    for (int index = 0; index < cpuCount; index++){
+        freePolicy(cpus[index].policy);
+    }
+    free(cpus);
+}
+
+// Discrete-event simulation: instead of stepping the clock one tick at a
+// time, jump straight to the next pending event. Events at the same
+// instant run as burst ends, I/O completions, kills, policy timer, then
+// idle CPUs are handed work; single-CPU FCFS matches the old tick-by-tick
+// loop exactly.
+bool runScheduler(ProcessTable* table, KillEvent* kills, int killCount, const SchedulerConfig* config, SimulationReport* report) {
+    Simulation sim = {0};
+    sim.table = table;
+    sim.totalProcesses = table->count;
+    sim.balance = config->balance;
+    sim.events = createMinHeap();
+    sim.cpus = calloc(config->cpuCount, sizeof(Cpu));
+    bool ready = sim.events && sim.cpus;
+    for (int index = 0; ready && index < config->cpuCount; index++){
+        sim.cpus[index].runningProcessId = -1;
+        sim.cpus[index].lastProcessId = -1;
+        sim.cpus[index].policy = createPolicy(config);
+        ready = sim.cpus[index].policy != NULL;
+        sim.cpuCount = index + 1;
+    }
+    if (!ready){
+        freeMinHeap(sim.events);
+        freeCpus(sim.cpus, sim.cpuCount);
+        return false;
+    }
+    sim.events->indexed = true;
+    if (report && report->recordTimeline){
+        sim.timeline = &report->timeline;
+    }
+
+    for (int index = 0; index < table->count; index++){
+        makeReady(&sim, &table->pcbs[index], table->pcbs[index].processId);
+    }
+    if (killCount > 0){
+        qsort(kills, killCount, sizeof(KillEvent), compareKillTime);
+    }
+    sim.kills = kills;
+    sim.killCount = killCount;
+    while (sim.killCursor < killCount && kills[sim.killCursor].time < 0){
+        sim.killCursor++;
+    }
+    if (sim.cpus[0].policy->ops->onTick && config->boostInterval > 0){
+        scheduleEvent(&sim, TIMER, config->boostInterval, -1, NULL);
+    }
+
+    while (sim.terminatedCount < sim.totalProcesses){
+        while (sim.events->size > 0 && sim.events->items[0].key == sim.clock && sim.events->items[0].tag != TIMER){
+            handleEvent(&sim, popHeap(sim.events));
+        }
+        applyDueKills(&sim);
+        while (sim.events->size > 0 && sim.events->items[0].key == sim.clock){
+            handleEvent(&sim, popHeap(sim.events));
+        }
+
+        if (sim.terminatedCount >= sim.totalProcesses){
+            break;
+        }
+
+        dispatchIdleCpus(&sim);
+
+        long long next = nextEventTime(&sim);
+        if (next == -1){
+            break;
+        }
+        sim.clock = next;
+    }
+
+    if (report){
+        report->makespan = sim.clock;
+        report->migrations = sim.migrations;
+        report->cpuCount = sim.cpuCount;
+        for (int index = 0; index < sim.cpuCount; index++){
+            report->cpus[index] = sim.cpus[index].stats;
+        }
+    }
+
+    freeCpus(sim.cpus, sim.cpuCount);
+    freeMinHeap(sim.events);
+    return true;
+}
+
+// Splits comma-separated ioStart and ioDuration lists into phases, e.g.
+// "3,7" and "2,4" (trace files separate with ';'). Returns -1 if the lists differ in length or are too
+// long; pairs with a negative start or no duration are dropped.
+int parseIoPhases(char* startList, char* durationList, IoPhase* phases) {
+    int count = 0;
+    char* startSave = NULL;
+    char* durationSave = NULL;
+    char* start = strtok_r(startList, ",;", &startSave);
+    char* duration = strtok_r(durationList, ",;", &durationSave);
+
+    while (start && duration){
+        if (count == MAX_IO_PHASES){
+            return -1;
+        }
+        int startTime = atoi(start);
+        int length = atoi(duration);
+        if (startTime >= 0 && length > 0){
+            phases[count].start = (unsigned int)startTime;
+            phases[count].duration = (unsigned int)length;
+            count++;
+        }
+        start = strtok_r(NULL, ",;", &startSave);
+        duration = strtok_r(NULL, ",;", &durationSave);
+    }
+
+    return (start || duration) ? -1 : count;
+}
+
+ProcessControlBlock* registerProcess(ProcessTable* table, const char* name, int pid, int burst, int priority, IoPhase* phases, int phaseCount) {
+    ProcessControlBlock* pcb = addProcess(table, pid);
+    if (!pcb){
+        return NULL;
+    }
+
+    strncpy(pcb->name, name, SIZE);
+    pcb->name[SIZE] = '\0';
+    pcb->burstTime = burst;
+    pcb->remBurstTime = burst;
+    pcb->priority = priority;
+
+    if (!setIoPhases(table, pcb, phases, phaseCount)){
+        return NULL;
+    }
+    return pcb;
+}
+
+void readProcessInput(ProcessTable* table, int* totalProcesses) {
+
+    printf("Enter number of processes: ");
+    char line[256];
+    if (!fgets(line, sizeof(line), stdin)) {
+        printf("Error reading number of processes!\n");
+        return;
+    }
+    *totalProcesses = atoi(line);
+
+    printf("name  pid  burst  ioStart  ioDuration\n");
+    printf("(Use '-' for no I/O)\n\n");
+
+    for (int i = 0; i < *totalProcesses; i++) {
+
+        printf("Process %d: ", i + 1);
+
+        char name[SIZE + 1];
+        char ioStartStr[128], ioDurStr[128];
+        IoPhase phases[MAX_IO_PHASES];
+        int phaseCount = 0;
+        int pid, burst;
+        int priority = 0;
+
+
+        if (!fgets(line, sizeof(line), stdin)) {
+            printf("Error reading process input!\n");
+            return;
+        }
+
+        int fields = sscanf(
+            line,
+            "%100s %d %d %127s %127s %d",
+            name, &pid, &burst, ioStartStr, ioDurStr, &priority
+        );
+
+        
+        if (fields >= 5 && strcmp(ioStartStr, "-") != 0 && strcmp(ioDurStr, "-") != 0) {
+            phaseCount = parseIoPhases(ioStartStr, ioDurStr, phases);
+        }
+
+        if (fields < 5 || burst <= 0 || phaseCount < 0) {
+            printf("Invalid input format! Please re-enter.\n");
+            i--;    
+            continue;
+        }
+
+        if (lookupProcess(table, pid)){
+            printf("Duplicate PID %d! Please re-enter.\n", pid);
+            i--;
+            continue;
+        }
+
+        if (!registerProcess(table, name, pid, burst, priority, phases, phaseCount)){
+            return;
+        }
+    }
+}
+
+
+void readKillEvents(KillEvent** kills, int* killCount) {
+
+    printf("\nEnter number of KILL events: ");
+    scanf("%d", killCount);
+
+    if (*killCount <= 0) {
+        return;
+    }
+
+    *kills = createKillEvents(*killCount);
+    printf("pid time\n\n");
+
+    for (int i = 0; i < *killCount; i++) {
+        scanf("%d %d", &(*kills)[i].processId, &(*kills)[i].time);
+    }
+}
+
+bool openOutput(OutputBuffer* output, const char* path) {
+    output->fd = (!path || strcmp(path, "-") == 0) ? STDOUT_FILENO : open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    output->used = 0;
+    output->failed = false;
+    output->data = malloc(OUTPUT_BUFFER_SIZE);
+    if (output->fd < 0 || !output->data){
+        printf("Cannot open output %s\n", path);
+        if (output->fd > STDOUT_FILENO){
+            close(output->fd);
+        }
+        free(output->data);
+        return false;
+    }
+    return true;
+}
+
+void flushOutput(OutputBuffer* output) {
+    size_t done = 0;
+    while (done < output->used && !output->failed){
+        ssize_t written = write(output->fd, output->data + done, output->used - done);
+        if (written <= 0){
+            output->failed = true;
+        }else{
+            done += written;
+        }
+    }
+    output->used = 0;
+}
+
+void writeOutput(OutputBuffer* output, const void* bytes, size_t length) {
+    if (length == 0){
+        return;
+    }
+    if (output->used + length > OUTPUT_BUFFER_SIZE){
+        flushOutput(output);
+    }
+    if (length > OUTPUT_BUFFER_SIZE){
+        memcpy(output->data, bytes, OUTPUT_BUFFER_SIZE);
+        output->used = OUTPUT_BUFFER_SIZE;
+        flushOutput(output);
+        writeOutput(output, (const char*)bytes + OUTPUT_BUFFER_SIZE, length - OUTPUT_BUFFER_SIZE);
+        return;
+    }
+    memcpy(output->data + output->used, bytes, length);
+    output->used += length;
+}
+
+bool closeOutput(OutputBuffer* output) {
+    flushOutput(output);
+    free(output->data);
+    if (output->fd > STDOUT_FILENO && close(output->fd) != 0){
+        output->failed = true;
+    }
+    if (output->failed){
+        printf("Error writing output!\n");
+    }
+    return !output->failed;
+}
+
+bool writeResults(ProcessTable* table, const char* path, bool binary) {
+    OutputBuffer output;
+    if (!openOutput(&output, path)){
+        return false;
+    }
+    ProcessControlBlock** order = sortByProcessId(table);
+    if (!order){
+        closeOutput(&output);
+        return false;
+    }
+
+    if (binary){
+        uint32_t header[3] = {0, 1, (uint32_t)table->count};
+        memcpy(header, "FCFR", 4);
+        writeOutput(&output, header, sizeof(header));
+    }else{
+        const char* columns = "pid,name,cpu,io,turnaround,waiting,status\n";
+        writeOutput(&output, columns, strlen(columns));
+    }
+
+    for (int index = 0; index < table->count; index++){
+        ProcessControlBlock* pcb = order[index];
+        if (binary){
+            ResultRecord record = {pcb->processId, pcb->burstTime, pcb->ioDuration, pcb->state == KILLED,
+                                   pcb->turnAroundTime, pcb->waitingTime};
+            writeOutput(&output, &record, sizeof(record));
+            continue;
+        }
+
+        char row[SIZE + 128];
+        int length = snprintf(row, sizeof(row), "%d,%s,%u,%u,%lld,%lld,%s\n",
+                              pcb->processId, pcb->name, pcb->burstTime, pcb->ioDuration, pcb->turnAroundTime, pcb->waitingTime,
+                              (pcb->state == KILLED) ? "KILLED" : "OK");
+        writeOutput(&output, row, length);
+    }
+
+    free(order);
+    return closeOutput(&output);
+}
+
+// Writes the loaded trace in binary form. Phases that never run (offset 0
+// or past the burst) are not kept in the table, so their share of the I/O
+// total is written back as one phase starting at the end of the burst.
+bool writeTrace(ProcessTable* table, KillEvent* kills, int killCount, const char* path) {
+    OutputBuffer output;
+    if (!openOutput(&output, path)){
+        return false;
+    }
+
+    TraceHeader header = {{'F', 'C', 'F', 'T'}, 1, (uint32_t)table->count, (uint32_t)killCount};
+    writeOutput(&output, &header, sizeof(header));
+
+    for (int index = 0; index < table->count; index++){
+        ProcessControlBlock* pcb = &table->pcbs[index];
+        unsigned int scheduled = 0;
+        for (int phase = pcb->ioPhase; phase < pcb->ioPhaseEnd; phase++){
+            scheduled += table->ioPhases[phase].duration;
+        }
+
+        TraceProcess record = {pcb->processId, pcb->burstTime, pcb->priority, (uint16_t)strlen(pcb->name),
+                               (uint16_t)(pcb->ioPhaseEnd - pcb->ioPhase + (pcb->ioDuration > scheduled))};
+        writeOutput(&output, &record, sizeof(record));
+        writeOutput(&output, pcb->name, record.nameLength);
+        writeOutput(&output, &table->ioPhases[pcb->ioPhase], sizeof(IoPhase) * (pcb->ioPhaseEnd - pcb->ioPhase));
+        if (pcb->ioDuration > scheduled){
+            IoPhase unreached = {pcb->burstTime, pcb->ioDuration - scheduled};
+            writeOutput(&output, &unreached, sizeof(unreached));
+        }
+    }
+    for (int index = 0; index < killCount; index++){
+        int32_t record[2] = {kills[index].processId, kills[index].time};
+        writeOutput(&output, record, sizeof(record));
+    }
+
+    return closeOutput(&output);
+}
+
+bool takeBytes(const char* data, size_t size, size_t* offset, void* out, size_t length) {
+    if (size - *offset < length){
+        return false;
+    }
+    memcpy(out, data + *offset, length);
+    *offset += length;
+    return true;
+}
+
+bool loadBinaryTrace(const char* data, size_t size, ProcessTable** table, KillEvent** kills, int* killCount) {
+    size_t offset = 0;
+    TraceHeader header;
+    if (!takeBytes(data, size, &offset, &header, sizeof(header)) || header.version != 1
+        || header.processCount > INT32_MAX || header.killCount > INT32_MAX){
+        printf("Unsupported trace file!\n");
+        return false;
+    }
+    // Every process and kill record takes at least its fixed-size part, so
+    // counts the mapping cannot hold are rejected before anything is sized
+    // from them.
+    if (header.processCount > (size - offset) / sizeof(TraceProcess)
+        || header.killCount > (size - offset - header.processCount * sizeof(TraceProcess)) / (2 * sizeof(int32_t))){
+        printf("Corrupt trace file: counts exceed file size!\n");
+        return false;
+    }
+
+    *table = createProcessTable(header.processCount);
+    if (!*table){
+        return false;
+    }
+
+    for (uint32_t index = 0; index < header.processCount; index++){
+        TraceProcess record;
+        char name[SIZE + 1] = {0};
+        IoPhase phases[MAX_IO_PHASES];
+        if (!takeBytes(data, size, &offset, &record, sizeof(record)) || record.nameLength > SIZE
+            || record.phaseCount > MAX_IO_PHASES
+            || !takeBytes(data, size, &offset, name, record.nameLength)
+            || !takeBytes(data, size, &offset, phases, sizeof(IoPhase) * record.phaseCount)){
+            printf("Corrupt trace file at process %u!\n", index + 1);
+            return false;
+        }
+        if ((int32_t)record.burstTime <= 0 || lookupProcess(*table, record.processId)){
+            printf("Invalid process %d in trace!\n", record.processId);
+            return false;
+        }
+        if (!registerProcess(*table, name, record.processId, record.burstTime, record.priority, phases, record.phaseCount)){
+            return false;
+        }
+    }
+
+    *killCount = (int)header.killCount;
+    if (*killCount > 0){
+        *kills = createKillEvents(*killCount);
+        if (!*kills){
+            return false;
+        }
+    }
+    for (int index = 0; index < *killCount; index++){
+        int32_t record[2];
+        if (!takeBytes(data, size, &offset, record, sizeof(record))){
+            printf("Corrupt trace file at kill %d!\n", index + 1);
+            return false;
+        }
+        (*kills)[index].processId = record[0];
+        (*kills)[index].time = record[1];
+    }
+    return true;
+}
+
+bool parseTraceNumber(const char* text, int* value) {
+    char* end = NULL;
+    long number = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || number < INT32_MIN || number > INT32_MAX){
+        return false;
+    }
+    *value = (int)number;
+    return true;
+}
+
+// CSV traces hold one record per line: "P,name,pid,burst,ioStart,
+// ioDuration[,priority]" for a process, with ';' between I/O phases and
+// '-' for none, or "K,pid,time" for a kill. Blank lines and lines
+// starting with '#' are skipped.
+bool loadCsvTrace(const char* data, size_t size, ProcessTable** table, KillEvent** kills, int* killCount) {
+    int lineCount = 0;
+    for (const char* scan = data; (scan = memchr(scan, '\n', data + size - scan)); scan++){
+        lineCount++;
+    }
+    *table = createProcessTable(lineCount + 1);
+    if (!*table){
+        return false;
+    }
+
+    int killCapacity = 0;
+    const char* cursor = data;
+    const char* end = data + size;
+    for (int lineNumber = 1; cursor < end; lineNumber++){
+        const char* newline = memchr(cursor, '\n', end - cursor);
+        const char* lineEnd = newline ? newline : end;
+        size_t length = lineEnd - cursor;
+        if (length > 0 && cursor[length - 1] == '\r'){
+            length--;
+        }
+
+        char line[512];
+        if (length >= sizeof(line)){
+            printf("Trace line %d is too long!\n", lineNumber);
+            return false;
+        }
+        memcpy(line, cursor, length);
+        line[length] = '\0';
+        cursor = newline ? newline + 1 : end;
+
+        if (length == 0 || line[0] == '#'){
+            continue;
+        }
+
+        char* fields[8];
+        int fieldCount = 0;
+        char* field = line;
+        while (fieldCount < 8){
+            fields[fieldCount++] = field;
+            char* comma = strchr(field, ',');
+            if (!comma){
+                break;
+            }
+            *comma = '\0';
+            field = comma + 1;
+        }
+
+        if (strcmp(fields[0], "P") == 0 && (fieldCount == 6 || fieldCount == 7)){
+            int pid, burst;
+            int priority = 0;
+            IoPhase phases[MAX_IO_PHASES];
+            int phaseCount = 0;
+            if (strcmp(fields[4], "-") != 0 && strcmp(fields[5], "-") != 0){
+                phaseCount = parseIoPhases(fields[4], fields[5], phases);
+            }
+            if (!parseTraceNumber(fields[2], &pid) || !parseTraceNumber(fields[3], &burst) || burst <= 0
+                || strlen(fields[1]) == 0 || strlen(fields[1]) > SIZE || phaseCount < 0
+                || (fieldCount == 7 && !parseTraceNumber(fields[6], &priority))){
+                printf("Trace line %d: invalid process!\n", lineNumber);
+                return false;
+            }
+            if (lookupProcess(*table, pid)){
+                printf("Trace line %d: duplicate PID %d!\n", lineNumber, pid);
+                return false;
+            }
+            if (!registerProcess(*table, fields[1], pid, burst, priority, phases, phaseCount)){
+                return false;
+            }
+        }else if (strcmp(fields[0], "K") == 0 && fieldCount == 3){
+            KillEvent kill;
+            if (!parseTraceNumber(fields[1], &kill.processId) || !parseTraceNumber(fields[2], &kill.time)){
+                printf("Trace line %d: invalid kill!\n", lineNumber);
+                return false;
+            }
+            if (*killCount == killCapacity){
+                killCapacity = killCapacity ? killCapacity * 2 : 64;
+                KillEvent* grown = realloc(*kills, sizeof(KillEvent) * killCapacity);
+                if (!grown){
+                    printf("Memory Allocation Failed!\n");
+                    return false;
+                }
+                *kills = grown;
+            }
+            (*kills)[(*killCount)++] = kill;
+        }else{
+            printf("Trace line %d: unknown record!\n", lineNumber);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Maps the whole trace read-only and parses it in place; the format is
+// picked from the magic bytes.
+bool loadTrace(const char* path, ProcessTable** table, KillEvent** kills, int* killCount) {
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0){
+        printf("Cannot open trace %s\n", path);
+        if (fd >= 0){
+            close(fd);
+        }
+        return false;
+    }
+
+    size_t size = (size_t)info.st_size;
+    const char* data = "";
+    if (size > 0){
+        void* mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED){
+            printf("Cannot map trace %s\n", path);
+            close(fd);
+            return false;
+        }
+        madvise(mapped, size, MADV_SEQUENTIAL);
+        data = mapped;
+    }
+    close(fd);
+
+    bool loaded;
+    if (size >= 4 && memcmp(data, "FCFT", 4) == 0){
+        loaded = loadBinaryTrace(data, size, table, kills, killCount);
+    }else{
+        loaded = loadCsvTrace(data, size, table, kills, killCount);
+    }
+
+    if (size > 0){
+        munmap((void*)data, size);
+    }
+    return loaded;
+}
+
+void simulateSweepRun(SweepQueue* queue, SweepRun* run) {
+    ProcessTable* table = cloneProcessTable(queue->trace);
+    KillEvent* kills = malloc(sizeof(KillEvent) * (queue->killCount > 0 ? queue->killCount : 1));
+    SimulationReport* report = calloc(1, sizeof(SimulationReport));
+
+    if (table && kills && report){
+        memcpy(kills, queue->kills, sizeof(KillEvent) * queue->killCount);
+        run->ok = runScheduler(table, kills, queue->killCount, &run->config, report);
+    }
+
+    if (run->ok){
+        long long turnaround = 0;
+        long long waiting = 0;
+        for (int index = 0; index < table->count; index++){
+            ProcessControlBlock* pcb = &table->pcbs[index];
+            if (pcb->state == KILLED){
+                run->killed++;
+            }else if (pcb->state == TERMINATED){
+                run->completed++;
+                turnaround += pcb->turnAroundTime;
+                waiting += pcb->waitingTime;
+            }
+        }
+        run->makespan = report->makespan;
+        if (run->completed > 0){
+            run->averageTurnaround = (double)turnaround / run->completed;
+            run->averageWaiting = (double)waiting / run->completed;
+        }
+        if (report->makespan > 0){
+            run->throughput = (double)run->completed / report->makespan;
+        }
+    }
+
+    free(report);
+    free(kills);
+    freeProcessTable(table);
+}
+
+void* sweepWorker(void* argument) {
+    SweepQueue* queue = argument;
+    while (true){
+        pthread_mutex_lock(&queue->lock);
+        int index = queue->nextRun++;
+        pthread_mutex_unlock(&queue->lock);
+
+        if (index >= queue->runCount){
+            return NULL;
+        }
+        simulateSweepRun(queue, &queue->runs[index]);
+    }
+}
+
+// Splits one "key=a,b,c" term of a sweep spec; returns the value count or
+// -1 if there are too many.
+int splitSweepValues(char* list, char** values) {
+    int count = 0;
+    char* save = NULL;
+    for (char* value = strtok_r(list, ",", &save); value; value = strtok_r(NULL, ",", &save)){
+        if (count == MAX_SWEEP_VALUES){
+            return -1;
+        }
+        values[count++] = value;
+    }
+    return count;
+}
+
+bool parsePolicyName(const char* name, PolicyKind* kind) {
+    for (int index = 0; index < (int)(sizeof(policyTable) / sizeof(policyTable[0])); index++){
+        if (strcmp(name, policyTable[index].name) == 0){
+            *kind = (PolicyKind)index;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool parseBalanceName(const char* name, BalanceMode* balance) {
+    if (strcmp(name, "push") == 0){
+        *balance = BALANCE_PUSH;
+    }else if (strcmp(name, "steal") == 0){
+        *balance = BALANCE_STEAL;
+    }else if (strcmp(name, "affinity") == 0){
+        *balance = BALANCE_AFFINITY;
+    }else{
+        return false;
+    }
+    return true;
+}
+
+// Expands a spec such as "policy=fcfs,rr;quantum=2,4,8;cpus=1,4" into the
+// cartesian product of runs; settings not swept come from base.
+SweepRun* buildSweepRuns(const char* spec, const SchedulerConfig* base, int* runCount) {
+    char text[1024];
+    if (strlen(spec) >= sizeof(text)){
+        return NULL;
+    }
+    strcpy(text, spec);
+
+    PolicyKind policies[MAX_SWEEP_VALUES] = {base->kind};
+    unsigned int quanta[MAX_SWEEP_VALUES] = {base->quantum};
+    int cpuCounts[MAX_SWEEP_VALUES] = {base->cpuCount};
+    BalanceMode balances[MAX_SWEEP_VALUES] = {base->balance};
+    int policyCount = 1, quantumCount = 1, cpuCountCount = 1, balanceCount = 1;
+
+    char* save = NULL;
+    for (char* term = strtok_r(text, ";", &save); term; term = strtok_r(NULL, ";", &save)){
+        char* equals = strchr(term, '=');
+        if (!equals){
+            return NULL;
+        }
+        *equals = '\0';
+        char* values[MAX_SWEEP_VALUES];
+        int count = splitSweepValues(equals + 1, values);
+        if (count <= 0){
+            return NULL;
+        }
+
+        for (int index = 0; index < count; index++){
+            bool valid = true;
+            if (strcmp(term, "policy") == 0){
+                valid = parsePolicyName(values[index], &policies[index]);
+                policyCount = count;
+            }else if (strcmp(term, "quantum") == 0){
+                quanta[index] = (unsigned int)atoi(values[index]);
+                valid = quanta[index] > 0;
+                quantumCount = count;
+            }else if (strcmp(term, "cpus") == 0){
+                cpuCounts[index] = atoi(values[index]);
+                valid = cpuCounts[index] >= 1 && cpuCounts[index] <= MAX_CPUS;
+                cpuCountCount = count;
+            }else if (strcmp(term, "balance") == 0){
+                valid = parseBalanceName(values[index], &balances[index]);
+                balanceCount = count;
+            }else{
+                valid = false;
+            }
+            if (!valid){
+                return NULL;
+            }
+        }
+    }
+
+    *runCount = policyCount * quantumCount * cpuCountCount * balanceCount;
+    SweepRun* runs = calloc(*runCount, sizeof(SweepRun));
+    if (!runs){
+        printf("Memory Allocation Failed!\n");
+        return NULL;
+    }
+
+    int run = 0;
+    for (int policy = 0; policy < policyCount; policy++){
+        for (int quantum = 0; quantum < quantumCount; quantum++){
+            for (int cpus = 0; cpus < cpuCountCount; cpus++){
+                for (int balance = 0; balance < balanceCount; balance++){
+                    runs[run].config = *base;
+                    runs[run].config.kind = policies[policy];
+                    runs[run].config.quantum = quanta[quantum];
+                    runs[run].config.cpuCount = cpuCounts[cpus];
+                    runs[run].config.balance = balances[balance];
+                    run++;
+                }
+            }
+        }
+    }
+    return runs;
+}
+
+const char* balanceName(BalanceMode balance) {
+    return (balance == BALANCE_PUSH) ? "push" : (balance == BALANCE_STEAL) ? "steal" : "affinity";
+}
+
+void printSweepReport(const SweepRun* runs, int runCount) {
+    printf("\n%-10s%-9s%-6s%-10s%-12s%-15s%-12s%-12s%-8s\n",
+           "Policy", "Quantum", "CPUs", "Balance", "Makespan", "AvgTurnaround", "AvgWaiting", "Throughput", "Killed");
+    printf("----------------------------------------------------------------------------------------------\n");
+
+    for (int index = 0; index < runCount; index++){
+        const SweepRun* run = &runs[index];
+        if (!run->ok){
+            printf("%-10s%-9u%-6d%-10s failed\n", policyTable[run->config.kind].name, run->config.quantum,
+                   run->config.cpuCount, balanceName(run->config.balance));
+            continue;
+        }
+        printf("%-10s%-9u%-6d%-10s%-12lld%-15.2f%-12.2f%-12.4f%-8d\n",
+               policyTable[run->config.kind].name, run->config.quantum, run->config.cpuCount,
+               balanceName(run->config.balance), run->makespan, run->averageTurnaround, run->averageWaiting,
+               run->throughput, run->killed);
+    }
+}
+
+// Runs every point of the grid on a pool of worker threads. The loaded
+// trace is shared read-only; each run simulates on its own copy.
+bool runSweep(const SchedulerConfig* config, const RunOptions* options, const ProcessTable* table,
+              const KillEvent* kills, int killCount) {
+    SweepQueue queue = {0};
+    queue.trace = table;
+    queue.kills = kills;
+    queue.killCount = killCount;
+    queue.runs = buildSweepRuns(options->sweepSpec, config, &queue.runCount);
+    if (!queue.runs){
+        printf("Invalid sweep specification: %s\n", options->sweepSpec);
+        return false;
+    }
+    pthread_mutex_init(&queue.lock, NULL);
+
+    int threadCount = options->threads;
+    if (threadCount <= 0){
+        threadCount = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (threadCount > queue.runCount){
+        threadCount = queue.runCount;
+    }
+    if (threadCount < 1){
+        threadCount = 1;
+    }
+
+    pthread_t* threads = malloc(sizeof(pthread_t) * threadCount);
+    int started = 0;
+    while (threads && started < threadCount && pthread_create(&threads[started], NULL, sweepWorker, &queue) == 0){
+        started++;
+    }
+    if (started == 0){
+        sweepWorker(&queue);
+    }
+    for (int index = 0; index < started; index++){
+        pthread_join(threads[index], NULL);
+    }
+
+    printSweepReport(queue.runs, queue.runCount);
+
+    bool ok = true;
+    for (int index = 0; index < queue.runCount; index++){
+        ok = ok && queue.runs[index].ok;
+    }
+    free(threads);
+    free(queue.runs);
+    pthread_mutex_destroy(&queue.lock);
+    return ok;
+}
+
+int compareLongLong(const void* left, const void* right) {
+    long long a = *(const long long*)left;
+    long long b = *(const long long*)right;
+    return (a > b) - (a < b);
+}
+
+// Nearest-rank percentile of an ascending array.
+long long percentile(const long long* sorted, int count, int percent) {
+    int rank = (int)(((long long)count * percent + 99) / 100);
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+void printPercentiles(const char* label, long long* values, int count) {
+    if (count == 0){
+        printf("%-12s%-12s\n", label, "-");
+        return;
+    }
+    qsort(values, count, sizeof(long long), compareLongLong);
+    printf("%-12s%-12lld%-12lld%-12lld%-12lld\n", label, percentile(values, count, 50), percentile(values, count, 95),
+           percentile(values, count, 99), values[count - 1]);
+}
+
+// Turnaround and waiting cover completed processes; response time is the
+// delay to first dispatch for every process that ran at all.
+void printMetrics(ProcessTable* table, const SimulationReport* report) {
+    long long* values = malloc(sizeof(long long) * (table->count > 0 ? table->count : 1));
+    if (!values){
+        printf("Memory Allocation Failed!\n");
+        return;
+    }
+
+    long long busy = 0;
+    long long switches = 0;
+    for (int index = 0; index < report->cpuCount; index++){
+        busy += report->cpus[index].busyTime;
+        switches += report->cpus[index].contextSwitches;
+    }
+    int completed = 0;
+    for (int index = 0; index < table->count; index++){
+        completed += table->pcbs[index].state == TERMINATED;
+    }
+
+    printf("\nMakespan: %lld\n", report->makespan);
+    printf("Throughput: %.4f processes/tick\n", report->makespan > 0 ? (double)completed / report->makespan : 0.0);
+    printf("CPU utilization: %.1f%%\n", report->makespan > 0 ? 100.0 * busy / ((double)report->makespan * report->cpuCount) : 0.0);
+    printf("Context switches: %lld\n", switches);
+    printf("\n%-12s%-12s%-12s%-12s%-12s\n", "", "p50", "p95", "p99", "max");
+
+    int count = 0;
+    for (int index = 0; index < table->count; index++){
+        if (table->pcbs[index].state == TERMINATED){
+            values[count++] = table->pcbs[index].turnAroundTime;
+        }
+    }
+    printPercentiles("Turnaround", values, count);
+
+    count = 0;
+    for (int index = 0; index < table->count; index++){
+        if (table->pcbs[index].state == TERMINATED){
+            values[count++] = table->pcbs[index].waitingTime;
+        }
+    }
+    printPercentiles("Waiting", values, count);
+
+    count = 0;
+    for (int index = 0; index < table->count; index++){
+        if (table->pcbs[index].firstRun != -1){
+            values[count++] = table->pcbs[index].firstRun;
+        }
+    }
+    printPercentiles("Response", values, count);
+
+    free(values);
+}
+
+void writeJsonString(OutputBuffer* output, const char* text) {
+    writeOutput(output, "\"", 1);
+    for (const char* cursor = text; *cursor; cursor++){
+        if (*cursor == '"' || *cursor == '\\'){
+            writeOutput(output, "\\", 1);
+        }
+        if ((unsigned char)*cursor >= 0x20){
+            writeOutput(output, cursor, 1);
+        }
+    }
+    writeOutput(output, "\"", 1);
+}
+
+// Writes the timeline as Chrome trace JSON (chrome://tracing, Perfetto):
+// one lane per CPU for run slices, one lane per process for I/O, and a
+// counter of busy CPUs over time. One tick is shown as one microsecond.
+bool writeTimeline(ProcessTable* table, const SimulationReport* report, const char* path) {
+    const Timeline* timeline = &report->timeline;
+    long long* changes = malloc(sizeof(long long) * 2 * (timeline->count > 0 ? timeline->count : 1));
+    OutputBuffer output;
+    if (!changes || !openOutput(&output, path)){
+        free(changes);
+        return false;
+    }
+
+    char text[256];
+    const char* header = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+                         "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"CPUs\"}},\n"
+                         "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":2,\"args\":{\"name\":\"I/O\"}}";
+    writeOutput(&output, header, strlen(header));
+    for (int index = 0; index < report->cpuCount; index++){
+        int length = snprintf(text, sizeof(text),
+                              ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"CPU %d\"}}",
+                              index, index);
+        writeOutput(&output, text, length);
+    }
+
+    int changeCount = 0;
+    for (int index = 0; index < timeline->count; index++){
+        const TimelineSlice* slice = &timeline->slices[index];
+        ProcessControlBlock* pcb = lookupProcess(table, slice->processId);
+        writeOutput(&output, ",\n{\"name\":", 10);
+        writeJsonString(&output, pcb ? pcb->name : "?");
+        int length = snprintf(text, sizeof(text),
+                              ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%d,\"tid\":%d,\"args\":{\"pid\":%d}}",
+                              slice->kind == SLICE_RUN ? "run" : "io", slice->start, slice->end - slice->start,
+                              slice->kind == SLICE_RUN ? 1 : 2, slice->kind == SLICE_RUN ? slice->cpu : slice->processId,
+                              slice->processId);
+        writeOutput(&output, text, length);
+
+        // Ends are stored as even and starts as odd values so that, at the
+        // same instant, a CPU freeing up sorts before one being taken.
+        if (slice->kind == SLICE_RUN){
+            changes[changeCount++] = slice->start * 2 + 1;
+            changes[changeCount++] = slice->end * 2;
+        }
+    }
+
+    qsort(changes, changeCount, sizeof(long long), compareLongLong);
+    int busy = 0;
+    for (int index = 0; index < changeCount; index++){
+        busy += (changes[index] & 1) ? 1 : -1;
+        if (index + 1 < changeCount && changes[index + 1] / 2 == changes[index] / 2){
+            continue;
+        }
+        int length = snprintf(text, sizeof(text), ",\n{\"name\":\"busy CPUs\",\"ph\":\"C\",\"ts\":%lld,\"pid\":1,\"args\":{\"busy\":%d}}",
+                              changes[index] / 2, busy);
+        writeOutput(&output, text, length);
+    }
+    writeOutput(&output, "\n]}\n", 4);
+
+    free(changes);
+    return closeOutput(&output);
+}
+
+bool reportRun(ProcessTable* table, const SimulationReport* report, const RunOptions* options) {
+    if (options->metrics){
+        printMetrics(table, report);
+    }
+    if (options->timelinePath){
+        return writeTimeline(table, report, options->timelinePath);
+    }
+    return true;
+}
+
+int runTrace(const SchedulerConfig* config, const RunOptions* options) {
+    ProcessTable* table = NULL;
+    KillEvent* kills = NULL;
+    int killCount = 0;
+    int status = 1;
+
+    if (loadTrace(options->tracePath, &table, &kills, &killCount)){
+        if (options->dumpPath){
+            status = writeTrace(table, kills, killCount, options->dumpPath) ? 0 : 1;
+        }else if (options->sweepSpec){
+            status = runSweep(config, options, table, kills, killCount) ? 0 : 1;
+        }else{
+            SimulationReport* report = calloc(1, sizeof(SimulationReport));
+            if (report){
+                report->recordTimeline = options->timelinePath != NULL;
+            }
+            if (report && runScheduler(table, kills, killCount, config, report)
+                && writeResults(table, options->outputPath, options->binaryOutput)){
+                status = 0;
+                if (report->cpuCount > 1 && options->outputPath && strcmp(options->outputPath, "-") != 0){
+                    printCpuStats(report);
+                }
+                if (!reportRun(table, report, options)){
+                    status = 1;
+                }
+            }
+            if (report){
+                free(report->timeline.slices);
+            }
+            free(report);
+        }
+    }
+
+    free(kills);
+    freeProcessTable(table);
+    return status;
+}
+
+void printUsage(const char* program) {
+    printf("Usage: %s [--policy fcfs|sjf|srtf|rr|priority|mlfq] [--quantum N]\n", program);
+    printf("          [--aging N] [--levels N] [--boost N]\n");
+    printf("          [--cpus N] [--balance push|steal|affinity] [--metrics] [--timeline FILE.json]\n");
+    printf("          [--trace FILE [--output FILE] [--format csv|binary] [--dump-trace FILE]]\n");
+    printf("          [--trace FILE --sweep \"policy=fcfs,rr;quantum=2,4;cpus=1,4;balance=steal\" [--threads N]]\n");
+}
+
+bool parseArguments(int argc, char* argv[], SchedulerConfig* config, RunOptions* options) {
+    config->kind = POLICY_FCFS;
+    config->quantum = 4;
+    config->agingInterval = 10;
+    config->mlfqLevels = 3;
+    config->boostInterval = 100;
+    config->cpuCount = 1;
+    config->balance = BALANCE_STEAL;
+    memset(options, 0, sizeof(RunOptions));
+
+    for (int index = 1; index < argc; index++){
+        const char* option = argv[index];
+        if (strcmp(option, "--metrics") == 0){
+            options->metrics = true;
+            continue;
+        }
+        if (index + 1 >= argc){
+            return false;
+        }
+        const char* value = argv[++index];
+
+        if (strcmp(option, "--policy") == 0){
+            if (!parsePolicyName(value, &config->kind)){
+                return false;
+            }
+        }else if (strcmp(option, "--quantum") == 0){
+            config->quantum = (unsigned int)atoi(value);
+        }else if (strcmp(option, "--aging") == 0){
+            config->agingInterval = (unsigned int)atoi(value);
+        }else if (strcmp(option, "--levels") == 0){
+            config->mlfqLevels = atoi(value);
+        }else if (strcmp(option, "--boost") == 0){
+            config->boostInterval = (unsigned int)atoi(value);
+        }else if (strcmp(option, "--cpus") == 0){
+            config->cpuCount = atoi(value);
+        }else if (strcmp(option, "--balance") == 0){
+            if (!parseBalanceName(value, &config->balance)){
+                return false;
+            }
+        }else if (strcmp(option, "--trace") == 0){
+            options->tracePath = value;
+        }else if (strcmp(option, "--output") == 0){
+            options->outputPath = value;
+        }else if (strcmp(option, "--dump-trace") == 0){
+            options->dumpPath = value;
+        }else if (strcmp(option, "--timeline") == 0){
+            options->timelinePath = value;
+        }else if (strcmp(option, "--sweep") == 0){
+            options->sweepSpec = value;
+        }else if (strcmp(option, "--threads") == 0){
+            options->threads = atoi(value);
+        }else if (strcmp(option, "--format") == 0){
+            if (strcmp(value, "csv") == 0){
+                options->binaryOutput = false;
+            }else if (strcmp(value, "binary") == 0){
+                options->binaryOutput = true;
+            }else{
+                return false;
+            }
+        }else{
+            return false;
+        }
+    }
+
+    if ((options->outputPath || options->dumpPath || options->binaryOutput || options->sweepSpec) && !options->tracePath){
+        return false;
+    }
+
+    if (config->quantum == 0 || config->mlfqLevels < 1 || config->mlfqLevels > MAX_MLFQ_LEVELS || config->cpuCount < 1 || config->cpuCount > MAX_CPUS){
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    SchedulerConfig config;
+    RunOptions options;
+    if (!parseArguments(argc, argv, &config, &options)){
+        printUsage(argv[0]);
+        return 1;
+    }
+    if (options.tracePath){
+        return runTrace(&config, &options);
+    }
+
+    ProcessTable* table = createProcessTable(PID_SLOTS_INIT);
+    if (!table){
+        return 1;
+    }
+
+    int totalProcesses = 0;
+    readProcessInput(table, &totalProcesses);
+
+    KillEvent* kills = NULL;
+    int killCount = 0;
+    readKillEvents(&kills, &killCount);
+
+    int status = 0;
+    SimulationReport* report = calloc(1, sizeof(SimulationReport));
+    if (report){
+        report->recordTimeline = options.timelinePath != NULL;
+    }
+    if (report && runScheduler(table, kills, killCount, &config, report)){
+        printResults(table);
+        if (report->cpuCount > 1){
+            printCpuStats(report);
+        }
+        if (!reportRun(table, report, &options)){
+            status = 1;
+        }
+    }
+    if (report){
+        free(report->timeline.slices);
+    }
+    free(report);
+
+    if (kills)
+    {
+        free(kills);
+    }
+
+    freeProcessTable(table);
+    return status;
+}
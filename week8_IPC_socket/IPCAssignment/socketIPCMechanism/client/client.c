@@ -1,8 +1,15 @@
 #include<stdio.h>
 #include<stdlib.h>
 #include<string.h>
+#include<stdint.h>
+#include<time.h>
+#include<poll.h>
 #include<unistd.h>
+#include<pthread.h>
+#include<errno.h>
+#include<sys/time.h>
 #include<arpa/inet.h>
+#include<netinet/tcp.h>
 
 #define PORT 8080
 #define BUFFER_SIZE 1024
@@ -10,7 +17,102 @@
 #define WITHDRAW 1
 #define DEPOSIT 2
 #define BALANCE 3
-#define EXIT 4
+#define TRANSFER 4
+#define EXIT 5
+#define STATS 6
+
+// Frames are a 4-byte big-endian length and a fixed body; see server.c.
+#define FRAME_HEADER_SIZE 4
+#define REQUEST_SIZE 36
+#define RESPONSE_SIZE 32
+#define STATS_HEADER_SIZE 24
+#define STATS_OPERATION_SIZE 64
+#define MAX_FRAME_SIZE 4096
+#define PIPELINE_DEPTH 64
+#define REPLY_TIMEOUT_MS 500
+#define MAX_RETRIES 3
+
+#define MAX_LOAD_THREADS 256
+#define LOAD_SLOTS 65536
+#define DRAIN_SECONDS 2
+#define PREFUND_CENTS 100000000
+#define HISTOGRAM_SUB_BITS 6
+#define HISTOGRAM_BUCKETS (64 << HISTOGRAM_SUB_BITS)
+
+#define STATUS_OK 0
+#define STATUS_INSUFFICIENT_FUNDS 1
+#define STATUS_INVALID_AMOUNT 2
+#define STATUS_UNKNOWN_ACCOUNT 3
+#define STATUS_SAME_ACCOUNT 4
+#define STATUS_INVALID_OPERATION 5
+#define STATUS_BUSY 6
+#define STATUS_EXPIRED 7
+#define STATUS_ID_REUSED 8
+
+typedef struct{
+    uint8_t operation;
+    uint32_t requestId;
+    int32_t account;
+    int32_t target;
+    int64_t amount;
+    uint64_t clientId;
+} Request;
+
+typedef struct{
+    uint8_t operation;
+    uint8_t status;
+    uint32_t requestId;
+    int32_t account;
+    int64_t amount;
+    int64_t balance;
+} Response;
+
+uint32_t nextRequestId = 1;
+uint64_t clientId;
+
+typedef struct{
+    int connections;
+    int threads;
+    double rate;
+    int duration;
+    int accounts;
+    int withdrawWeight;
+    int depositWeight;
+    int balanceWeight;
+    uint64_t hedgeNanos;
+} LoadOptions;
+
+// Log-linear latency histogram in the style of HdrHistogram: values below
+// 128ns are exact, above that each power of two is split into 64 buckets,
+// which keeps every recorded value within about 1.6%.
+typedef struct{
+    uint64_t counts[HISTOGRAM_BUCKETS];
+    uint64_t total;
+    uint64_t max;
+} Histogram;
+
+typedef struct{
+    const LoadOptions* options;
+    int threadNumber;
+    int connectionCount;
+    int* sockets;
+    unsigned char* inboxes;
+    size_t* inboxLengths;
+    uint64_t* sendTimes;
+    Request* requests;
+    int* sentOn;
+    unsigned char* answered;
+    uint64_t clientId;
+    uint64_t hedged;
+    uint64_t sent;
+    uint64_t completed;
+    uint64_t failed;
+    uint64_t busy;
+    uint64_t timedOut;
+    uint64_t outstanding;
+    Histogram histogram;
+    pthread_t thread;
+} LoadWorker;
 
 void displayMenu(){
     printf("\n============================================\n");
@@ -19,7 +121,8 @@ void displayMenu(){
     printf("1. Withdraw Amount\n");
     printf("2. Deposit Amount\n");
     printf("3. Display Balance\n");
-    printf("4. Exit\n");
+    printf("4. Transfer Amount\n");
+    printf("5. Exit\n");
     printf("============================================\n");
     printf("Enter your choice: ");
 }
@@ -36,8 +139,8 @@ int getValidChoice(){
                 printf("Invalid input. Please enter again: ");
                 while(getchar() != '\n');
             } 
-            else if(choice < 1 || choice > 4){
-                printf("Invalid choice. Enter 1-4: ");
+            else if(choice < 1 || choice > 5){
+                printf("Invalid choice. Enter 1-5: ");
             } 
             else{
                 return choice;
@@ -46,10 +149,59 @@ int getValidChoice(){
     }
 }
 
-float getValidAmount(){
-    float amount;
+// Parses "[-]units[.cc]" into cents without going through floating point.
+int parseCents(const char* text, int64_t* cents){
+    int negative = *text == '-';
+    int64_t value = 0;
+    int fraction = -1;
+
+    if(negative) text++;
+    if(*text < '0' || *text > '9') return 0;
+
+    for(; *text && *text != '\n' && *text != '\r'; text++){
+        if(*text == '.' && fraction < 0){
+            fraction = 0;
+            continue;
+        }
+        if(*text < '0' || *text > '9' || fraction == 2 || value > (INT64_MAX - 9) / 10){
+            return 0;
+        }
+        value = value * 10 + (*text - '0');
+        if(fraction >= 0) fraction++;
+    }
+    for(int digits = fraction < 0 ? 0 : fraction; digits < 2; digits++){
+        if(value > INT64_MAX / 10) return 0;
+        value *= 10;
+    }
+
+    *cents = negative ? -value : value;
+    return 1;
+}
+
+int64_t getValidAmount(){
+    char line[64];
+    int64_t amount;
     while(1){
-        if(scanf("%f", &amount) != 1){
+        if(!fgets(line, sizeof(line), stdin)){
+            printf("\n");
+            exit(0);
+        }
+        if(!parseCents(line, &amount)){
+            printf("Invalid input. Please enter again: ");
+        } 
+        else if(amount <= 0){
+            printf("Amount must be positive. Enter again: ");
+        } 
+        else{
+            return amount;
+        }
+    }
+}
+
+int getValidAccount(){
+    int account;
+    while(1){
+        if(scanf("%d", &account) != 1){
             printf("Invalid input. Please enter again: ");
             while(getchar() != '\n');
         } 
@@ -58,79 +210,220 @@ float getValidAmount(){
                 printf("Invalid input. Please enter again: ");
                 while(getchar() != '\n');
             } 
-            else if(amount <= 0){
-                printf("Amount must be positive. Enter again: ");
+            else if(account <= 0){
+                printf("Account number must be positive. Enter again: ");
             } 
             else{
-                return amount;
+                return account;
             }
         }
     }
 }
 
-void prepareWithdrawRequest(char* request){
+void prepareWithdrawRequest(Request* request){
     printf("Enter amount to withdraw: ");
-    float amount = getValidAmount();
-    snprintf(request, BUFFER_SIZE, "%d %.2f", WITHDRAW, amount);
+    request->amount = getValidAmount();
 }
 
-void prepareDepositRequest(char* request){
+void prepareDepositRequest(Request* request){
     printf("Enter amount to deposit: ");
-    float amount = getValidAmount();
-    snprintf(request, BUFFER_SIZE, "%d %.2f", DEPOSIT, amount);
+    request->amount = getValidAmount();
 }
 
-void prepareBalanceRequest(char* request){
-    snprintf(request, BUFFER_SIZE, "%d 0", BALANCE);
+void prepareTransferRequest(Request* request){
+    printf("Enter account to transfer to: ");
+    request->target = getValidAccount();
+    printf("Enter amount to transfer: ");
+    request->amount = getValidAmount();
 }
 
-void prepareExitRequest(char* request){
-    snprintf(request, BUFFER_SIZE, "%d 0", EXIT);
-}
+int prepareRequest(int choice, int account, Request* request){
+    memset(request, 0, sizeof(*request));
+    request->operation = choice;
+    request->requestId = nextRequestId++;
+    request->account = account;
+    request->clientId = clientId;
 
-int prepareRequest(int choice, char* request){
     if(choice == WITHDRAW){
         prepareWithdrawRequest(request);
     }
     else if(choice == DEPOSIT){
         prepareDepositRequest(request);
     }
-    else if(choice == BALANCE){
-        prepareBalanceRequest(request);
+    else if(choice == TRANSFER){
+        prepareTransferRequest(request);
     }
     else if(choice == EXIT){
-        prepareExitRequest(request);
         return 0;
     }
     return 1;
 }
 
-void sendRequest(int clientSocket, char *request){
-    ssize_t bytesSent = send(clientSocket, request, strlen(request), 0);
+void putUint32(unsigned char* bytes, uint32_t value){
+    bytes[0] = value >> 24;
+    bytes[1] = value >> 16;
+    bytes[2] = value >> 8;
+    bytes[3] = value;
+}
+
+uint32_t getUint32(const unsigned char* bytes){
+    return ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | bytes[3];
+}
+
+uint64_t getUint64(const unsigned char* bytes){
+    return ((uint64_t)getUint32(bytes) << 32) | getUint32(bytes + 4);
+}
+
+void encodeRequest(const Request* request, unsigned char* frame){
+    memset(frame, 0, REQUEST_SIZE);
+    putUint32(frame, REQUEST_SIZE - FRAME_HEADER_SIZE);
+    frame[4] = request->operation;
+    putUint32(frame + 8, request->requestId);
+    putUint32(frame + 12, (uint32_t)request->account);
+    putUint32(frame + 16, (uint32_t)request->target);
+    putUint32(frame + 20, (uint64_t)request->amount >> 32);
+    putUint32(frame + 24, (uint32_t)request->amount);
+    putUint32(frame + 28, request->clientId >> 32);
+    putUint32(frame + 32, (uint32_t)request->clientId);
+}
+
+void decodeResponse(const unsigned char* frame, Response* response){
+    response->operation = frame[4];
+    response->status = frame[5];
+    response->requestId = getUint32(frame + 8);
+    response->account = (int32_t)getUint32(frame + 12);
+    response->amount = (int64_t)getUint64(frame + 16);
+    response->balance = (int64_t)getUint64(frame + 24);
+}
 
-    if (bytesSent < 0) {
-        perror("send failed");
+void formatCents(int64_t cents, char* text, size_t size){
+    snprintf(text, size, "%s%lld.%02lld", cents < 0 ? "-" : "",
+             (long long)(cents < 0 ? -cents : cents) / 100, (long long)(cents < 0 ? -cents : cents) % 100);
+}
+
+void formatResponse(const Response* response, char* text, size_t size){
+    char amount[32], balance[32];
+    formatCents(response->amount, amount, sizeof(amount));
+    formatCents(response->balance, balance, sizeof(balance));
+
+    if(response->status == STATUS_INSUFFICIENT_FUNDS){
+        snprintf(text, size, "FAILED: Insufficient balance. Current balance: %s", balance);
+    }
+    else if(response->status == STATUS_INVALID_AMOUNT){
+        snprintf(text, size, "FAILED: Invalid amount.");
+    }
+    else if(response->status == STATUS_UNKNOWN_ACCOUNT){
+        snprintf(text, size, "FAILED: Unknown account.");
+    }
+    else if(response->status == STATUS_SAME_ACCOUNT){
+        snprintf(text, size, "FAILED: Cannot transfer to the same account.");
+    }
+    else if(response->status == STATUS_BUSY){
+        snprintf(text, size, "FAILED: Server busy. Please try again.");
+    }
+    else if(response->status == STATUS_EXPIRED){
+        snprintf(text, size, "FAILED: Request too old for the server to tell if it ran. Check your balance.");
+    }
+    else if(response->status == STATUS_ID_REUSED){
+        snprintf(text, size, "FAILED: Request id already used for a different request.");
+    }
+    else if(response->status != STATUS_OK){
+        snprintf(text, size, "Invalid operation.");
+    }
+    else if(response->operation == WITHDRAW){
+        snprintf(text, size, "SUCCESS: Withdrawn %s. New balance: %s", amount, balance);
+    }
+    else if(response->operation == DEPOSIT){
+        snprintf(text, size, "SUCCESS: Deposited %s. New balance: %s", amount, balance);
+    }
+    else if(response->operation == TRANSFER){
+        snprintf(text, size, "SUCCESS: Transferred %s. New balance: %s", amount, balance);
+    }
+    else{
+        snprintf(text, size, "Current balance: %s", balance);
     }
 }
 
+int sendRequest(int clientSocket, const Request* request){
+    unsigned char frame[REQUEST_SIZE];
+    encodeRequest(request, frame);
 
-void receiveAndDisplayResponse(int clientSocket){
-    char buffer[BUFFER_SIZE];
-    memset(buffer, 0, BUFFER_SIZE);
-    ssize_t bytesRead = recv(clientSocket, buffer, sizeof(buffer) - 1, 0);
+    size_t sent = 0;
+    while(sent < sizeof(frame)){
+        ssize_t bytesSent = send(clientSocket, frame + sent, sizeof(frame) - sent, 0);
+        if (bytesSent < 0) {
+            perror("send failed");
+            return 0;
+        }
+        sent += bytesSent;
+    }
+    return 1;
+}
 
-    if (bytesRead < 0) {
-        perror("recv failed");
-        return;
+// Frames may arrive split across reads, so keep reading until one is whole.
+int receiveExactly(int clientSocket, unsigned char* bytes, size_t size){
+    size_t length = 0;
+
+    while(length < size){
+        ssize_t bytesRead = recv(clientSocket, bytes + length, size - length, 0);
+
+        if (bytesRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            printf("No reply from server.\n");
+            return 0;
+        }
+        if (bytesRead < 0) {
+            perror("recv failed");
+            return 0;
+        }
+
+        if (bytesRead == 0) {
+            printf("Server closed the connection.\n");
+            return 0;
+        }
+        length += bytesRead;
     }
+    return 1;
+}
 
-    if (bytesRead == 0) {
-        printf("Server closed the connection.\n");
-        return;
+// Reads one length-prefixed frame into frame and returns its total size.
+size_t receiveFrame(int clientSocket, unsigned char* frame, size_t capacity){
+    if(!receiveExactly(clientSocket, frame, FRAME_HEADER_SIZE)){
+        return 0;
     }
 
+    uint32_t bodyLength = getUint32(frame);
+    if(bodyLength > capacity - FRAME_HEADER_SIZE){
+        printf("Malformed response from server.\n");
+        return 0;
+    }
+    if(!receiveExactly(clientSocket, frame + FRAME_HEADER_SIZE, bodyLength)){
+        return 0;
+    }
+    return FRAME_HEADER_SIZE + bodyLength;
+}
+
+int receiveResponse(int clientSocket, Response* response){
+    unsigned char frame[RESPONSE_SIZE];
+
+    size_t length = receiveFrame(clientSocket, frame, sizeof(frame));
+    if(length == 0){
+        return 0;
+    }
+    if(length != RESPONSE_SIZE){
+        printf("Malformed response from server.\n");
+        return 0;
+    }
+    decodeResponse(frame, response);
+    return 1;
+}
+
+void displayResponse(const Response* response){
+    char text[BUFFER_SIZE];
+
+    formatResponse(response, text, sizeof(text));
+
     printf("\n--- Server Response ---\n");
-    printf("%s\n", buffer);
+    printf("%s\n", text);
     printf("=======================\n");
 }
 
@@ -159,22 +452,74 @@ int connectToServer(int clientSocket){
     return 1;
 }
 
-void handleTransactions(int clientSocket){
-    char request[BUFFER_SIZE];
+// Interactive requests wait at most REPLY_TIMEOUT_MS for their reply.
+int openInteractiveConnection(){
+    int clientSocket = createClientSocket();
+    if(clientSocket == -1) return -1;
+
+    if(!connectToServer(clientSocket)){
+        close(clientSocket);
+        return -1;
+    }
+
+    struct timeval timeout = {0, REPLY_TIMEOUT_MS * 1000};
+    setsockopt(clientSocket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    return clientSocket;
+}
+
+// A request that times out, loses its connection or is turned away BUSY
+// is sent again, unchanged, on a fresh connection after a growing pause.
+// The server keeps the replies it gave this client id, so a retry of a
+// request that did go through returns the first reply instead of running
+// it twice; one the server no longer remembers comes back EXPIRED and is
+// not retried. The old connection is dropped so its late reply cannot be
+// mistaken for the next one.
+int exchangeRequest(int* clientSocket, const Request* request, Response* response){
+    for(int attempt = 0; attempt <= MAX_RETRIES; attempt++){
+        if(attempt > 0){
+            usleep((REPLY_TIMEOUT_MS * 1000) << (attempt - 1));
+            printf("Retrying request %u (attempt %d of %d).\n", request->requestId, attempt, MAX_RETRIES);
+        }
+        if(*clientSocket == -1 && (*clientSocket = openInteractiveConnection()) == -1){
+            continue;
+        }
+
+        if(!sendRequest(*clientSocket, request) || !receiveResponse(*clientSocket, response)){
+            close(*clientSocket);
+            *clientSocket = -1;
+            continue;
+        }
+        if(response->status != STATUS_BUSY || attempt == MAX_RETRIES){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void handleTransactions(int* clientSocket){
+    Request request;
+    Response response;
+
+    printf("Enter your account number: ");
+    int account = getValidAccount();
     
     while(1){
         displayMenu();
         int choice = getValidChoice();
         
-        if(!prepareRequest(choice, request)){
-            sendRequest(clientSocket, request);
+        if(!prepareRequest(choice, account, &request)){
+            if(*clientSocket != -1) sendRequest(*clientSocket, &request);
             printf("\nThank you for using our ATM service!\n");
             printf("============================================\n");
             break;
         }
         
-        sendRequest(clientSocket, request);
-        receiveAndDisplayResponse(clientSocket);
+        if(exchangeRequest(clientSocket, &request, &response)){
+            displayResponse(&response);
+        }
+        else{
+            printf("Error: Server did not answer. Please try again.\n");
+        }
     }
 }
 
@@ -183,20 +528,596 @@ void initiateClient(){
     printf("ATM Client - Socket IPC Mechanism");
     printf("\n============================================\n");
     
-    int clientSocket = createClientSocket();
+    int clientSocket = openInteractiveConnection();
     if(clientSocket == -1) return;
     
+    handleTransactions(&clientSocket);
+    
+    if(clientSocket != -1) close(clientSocket);
+}
+
+int parseBatchLine(const char* line, Request* request){
+    int operation = 0, account = 0, target = 0;
+    char amount[32] = "0";
+    int64_t cents = 0;
+
+    if(sscanf(line, "%d %d %31s %d", &operation, &account, amount, &target) < 2 || !parseCents(amount, &cents)){
+        return 0;
+    }
+    request->operation = operation;
+    request->requestId = nextRequestId++;
+    request->account = account;
+    request->target = target;
+    request->amount = cents;
+    request->clientId = clientId;
+    return 1;
+}
+
+// Reads "operation account [amount [target]]" lines from stdin and keeps
+// up to PIPELINE_DEPTH requests in flight instead of waiting for each
+// reply before sending the next.
+void runBatch(){
+    int clientSocket = createClientSocket();
+    if(clientSocket == -1) return;
+
     if(!connectToServer(clientSocket)){
         close(clientSocket);
         return;
     }
-    
-    handleTransactions(clientSocket);
-    
+
+    char line[BUFFER_SIZE];
+    int inFlight = 0;
+    int moreInput = 1;
+
+    while(moreInput || inFlight > 0){
+        while(moreInput && inFlight < PIPELINE_DEPTH){
+            Request request;
+            if(!fgets(line, sizeof(line), stdin)){
+                moreInput = 0;
+                break;
+            }
+            if(!parseBatchLine(line, &request)){
+                continue;
+            }
+            if(!sendRequest(clientSocket, &request)){
+                close(clientSocket);
+                return;
+            }
+            inFlight++;
+        }
+
+        if(inFlight > 0){
+            Response response;
+            char text[BUFFER_SIZE];
+            if(!receiveResponse(clientSocket, &response)){
+                break;
+            }
+            formatResponse(&response, text, sizeof(text));
+            printf("[%u] Account %d: %s\n", response.requestId, response.account, text);
+            inFlight--;
+        }
+    }
+
+    close(clientSocket);
+}
+
+// Asks the server for its per-operation counters and latency percentiles.
+void runStats(){
+    static const char* operationNames[] = {"Withdraw", "Deposit", "Balance", "Transfer"};
+    unsigned char frame[MAX_FRAME_SIZE];
+
+    int clientSocket = createClientSocket();
+    if(clientSocket == -1) return;
+
+    if(!connectToServer(clientSocket)){
+        close(clientSocket);
+        return;
+    }
+
+    Request request = {STATS, nextRequestId++, 0, 0, 0, clientId};
+    if(!sendRequest(clientSocket, &request)){
+        close(clientSocket);
+        return;
+    }
+
+    size_t length = receiveFrame(clientSocket, frame, sizeof(frame));
+    close(clientSocket);
+    if(length == 0){
+        return;
+    }
+    if(length < STATS_HEADER_SIZE || frame[4] != STATS || frame[5] != STATUS_OK){
+        printf("Server did not return statistics.\n");
+        return;
+    }
+
+    uint32_t operationCount = getUint32(frame + 12);
+    if(operationCount > 4 || length < STATS_HEADER_SIZE + operationCount * STATS_OPERATION_SIZE){
+        printf("Malformed response from server.\n");
+        return;
+    }
+
+    printf("\n%-10s %10s %8s %8s %10s %10s %10s %10s %10s\n", "Operation", "Requests", "Errors", "Busy",
+        "p50(us)", "p90(us)", "p99(us)", "p99.9(us)", "max(us)");
+    for(uint32_t operation = 0; operation < operationCount; operation++){
+        const unsigned char* fields = frame + STATS_HEADER_SIZE + operation * STATS_OPERATION_SIZE;
+        printf("%-10s %10llu %8llu %8llu", operationNames[operation],
+            (unsigned long long)getUint64(fields), (unsigned long long)getUint64(fields + 8),
+            (unsigned long long)getUint64(fields + 16));
+        for(int column = 0; column < 5; column++){
+            printf(" %10.1f", getUint64(fields + 24 + column * 8) / 1000.0);
+        }
+        printf("\n");
+    }
+    printf("Log lines dropped: %llu\n", (unsigned long long)getUint64(frame + 16));
+}
+
+uint64_t monotonicNanos(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+int histogramIndex(uint64_t value){
+    if(value < (2u << HISTOGRAM_SUB_BITS)) return (int)value;
+
+    int shift = 63 - __builtin_clzll(value) - HISTOGRAM_SUB_BITS;
+    return ((shift + 1) << HISTOGRAM_SUB_BITS) + (int)((value >> shift) - (1u << HISTOGRAM_SUB_BITS));
+}
+
+uint64_t histogramValue(int index){
+    if(index < (2 << HISTOGRAM_SUB_BITS)) return index;
+
+    int shift = (index >> HISTOGRAM_SUB_BITS) - 1;
+    uint64_t subBucket = (index & ((1 << HISTOGRAM_SUB_BITS) - 1)) + (1u << HISTOGRAM_SUB_BITS);
+    return ((subBucket + 1) << shift) - 1;
+}
+
+void recordLatency(Histogram* histogram, uint64_t nanos){
+    histogram->counts[histogramIndex(nanos)]++;
+    histogram->total++;
+    if(nanos > histogram->max) histogram->max = nanos;
+}
+
+uint64_t histogramPercentile(const Histogram* histogram, double percentile){
+    uint64_t target = (uint64_t)(histogram->total * percentile / 100.0 + 0.5);
+    uint64_t seen = 0;
+
+    if(target == 0) target = 1;
+    for(int index = 0; index < HISTOGRAM_BUCKETS; index++){
+        seen += histogram->counts[index];
+        if(seen >= target){
+            uint64_t value = histogramValue(index);
+            return value < histogram->max ? value : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+int openLoadConnection(){
+    int clientSocket = createClientSocket();
+    if(clientSocket == -1) return -1;
+
+    struct sockaddr_in serverAddr;
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_port = htons(PORT);
+    serverAddr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    if(connect(clientSocket, (struct sockaddr*)&serverAddr, sizeof(serverAddr)) < 0){
+        close(clientSocket);
+        return -1;
+    }
+
+    int on = 1;
+    setsockopt(clientSocket, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return clientSocket;
+}
+
+uint64_t nextRandom(uint64_t* state){
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+void buildLoadRequest(const LoadOptions* options, uint64_t* random, uint32_t requestId, Request* request){
+    int totalWeight = options->withdrawWeight + options->depositWeight + options->balanceWeight;
+    int pick = (int)(nextRandom(random) % totalWeight);
+
+    memset(request, 0, sizeof(*request));
+    request->requestId = requestId;
+    request->account = 1 + (int)(nextRandom(random) % options->accounts);
+    request->amount = 1 + (int64_t)(nextRandom(random) % 10000);
+
+    if(pick < options->withdrawWeight){
+        request->operation = WITHDRAW;
+    }
+    else if(pick < options->withdrawWeight + options->depositWeight){
+        request->operation = DEPOSIT;
+    }
+    else{
+        request->operation = BALANCE;
+        request->amount = 0;
+    }
+}
+
+void collectResponses(LoadWorker* worker, int connection){
+    unsigned char* inbox = worker->inboxes + (size_t)connection * BUFFER_SIZE;
+    size_t* length = &worker->inboxLengths[connection];
+
+    while(1){
+        ssize_t bytesRead = recv(worker->sockets[connection], inbox + *length, BUFFER_SIZE - *length, MSG_DONTWAIT);
+        if(bytesRead <= 0) break;
+        *length += bytesRead;
+
+        uint64_t now = monotonicNanos();
+        size_t start = 0;
+        while(*length - start >= RESPONSE_SIZE){
+            Response response;
+            decodeResponse(inbox + start, &response);
+            start += RESPONSE_SIZE;
+
+            // The first reply to a hedged request wins; the other copy's
+            // reply finds the slot already answered.
+            size_t slot = response.requestId % LOAD_SLOTS;
+            if(worker->answered[slot] || worker->requests[slot].requestId != response.requestId) continue;
+            worker->answered[slot] = 1;
+
+            recordLatency(&worker->histogram, now - worker->sendTimes[slot]);
+            worker->completed++;
+            worker->outstanding--;
+            if(response.status == STATUS_BUSY) worker->busy++;
+            else if(response.status != STATUS_OK) worker->failed++;
+        }
+        memmove(inbox, inbox + start, *length - start);
+        *length -= start;
+    }
+}
+
+// Gives up on the request in a slot that is still unanswered, either
+// because the slot is about to be reused or because the run is over. Its
+// age so far goes into the histogram, so a reply that never arrives counts
+// as the slowest kind of reply instead of vanishing from the percentiles.
+void expireRequest(LoadWorker* worker, size_t slot, uint64_t now){
+    worker->answered[slot] = 1;
+    recordLatency(&worker->histogram, now - worker->sendTimes[slot]);
+    worker->timedOut++;
+    worker->outstanding--;
+}
+
+// Sends a second copy of every request still unanswered hedgeNanos after
+// it was due, on the next connection over. Both copies carry the same
+// client and request id, so the server runs the request only once.
+uint64_t hedgeRequests(LoadWorker* worker, uint32_t hedgeId, uint32_t requestId, uint64_t now){
+    uint64_t hedgeNanos = worker->options->hedgeNanos;
+
+    while(hedgeId != requestId){
+        size_t slot = hedgeId % LOAD_SLOTS;
+        if(worker->requests[slot].requestId == hedgeId){
+            if(worker->sendTimes[slot] + hedgeNanos > now) break;
+            if(!worker->answered[slot]){
+                int connection = (worker->sentOn[slot] + 1) % worker->connectionCount;
+                if(sendRequest(worker->sockets[connection], &worker->requests[slot])) worker->hedged++;
+            }
+        }
+        hedgeId++;
+    }
+    return hedgeId;
+}
+
+// Open loop: request i is due at start + i * interval no matter how the
+// previous ones fared, and its latency is measured from that due time, so
+// a stalled server shows up in the percentiles instead of slowing the
+// sender down (coordinated omission).
+void* runLoadWorker(void* arg){
+    LoadWorker* worker = (LoadWorker*)arg;
+    const LoadOptions* options = worker->options;
+    struct pollfd* fds = calloc(worker->connectionCount, sizeof(struct pollfd));
+    uint64_t random = 0x9E3779B97F4A7C15ull * (worker->threadNumber + 1);
+    uint64_t interval = (uint64_t)(1e9 * options->threads / options->rate);
+    uint64_t start = monotonicNanos();
+    uint64_t end = start + (uint64_t)options->duration * 1000000000ull;
+    uint64_t due = start + interval * worker->threadNumber / options->threads;
+    uint32_t requestId = 0;
+    uint32_t hedgeId = 0;
+    int nextConnection = 0;
+
+    if(!fds) return NULL;
+    for(int index = 0; index < worker->connectionCount; index++){
+        fds[index].fd = worker->sockets[index];
+        fds[index].events = POLLIN;
+    }
+
+    while(1){
+        uint64_t now = monotonicNanos();
+        while(due <= now && due < end){
+            // The slot last held request requestId - LOAD_SLOTS; if that one
+            // is still waiting its reply could no longer be matched anyway.
+            size_t slot = requestId % LOAD_SLOTS;
+            if(!worker->answered[slot]) expireRequest(worker, slot, now);
+
+            Request* request = &worker->requests[slot];
+            buildLoadRequest(options, &random, requestId, request);
+            request->clientId = worker->clientId;
+            worker->sendTimes[slot] = due;
+            worker->sentOn[slot] = nextConnection;
+            worker->answered[slot] = 0;
+            requestId++;
+            if(!sendRequest(worker->sockets[nextConnection], request)){
+                end = due;
+                break;
+            }
+            worker->sent++;
+            worker->outstanding++;
+            nextConnection = (nextConnection + 1) % worker->connectionCount;
+            due += interval;
+        }
+
+        if(due >= end && (worker->outstanding == 0 || now >= end + DRAIN_SECONDS * 1000000000ull)) break;
+
+        int timeout = due < end ? (int)((due - now) / 1000000) : 10;
+        if(options->hedgeNanos > 0 && worker->connectionCount > 1){
+            hedgeId = hedgeRequests(worker, hedgeId, requestId, now);
+            if(hedgeId != requestId){
+                uint64_t hedgeAt = worker->sendTimes[hedgeId % LOAD_SLOTS] + options->hedgeNanos;
+                int hedgeTimeout = hedgeAt > now ? (int)((hedgeAt - now) / 1000000) : 0;
+                if(hedgeTimeout < timeout) timeout = hedgeTimeout;
+            }
+        }
+        if(poll(fds, worker->connectionCount, timeout) < 0) continue;
+
+        for(int index = 0; index < worker->connectionCount; index++){
+            if(fds[index].revents & (POLLIN | POLLHUP | POLLERR)){
+                collectResponses(worker, index);
+            }
+        }
+    }
+
+    uint64_t now = monotonicNanos();
+    for(size_t slot = 0; slot < LOAD_SLOTS && worker->outstanding > 0; slot++){
+        if(!worker->answered[slot]) expireRequest(worker, slot, now);
+    }
+
+    free(fds);
+    return NULL;
+}
+
+int prefundAccounts(const LoadOptions* options){
+    int clientSocket = openLoadConnection();
+    if(clientSocket == -1) return 0;
+
+    int inFlight = 0;
+    for(int account = 1; account <= options->accounts || inFlight > 0; account++){
+        if(account <= options->accounts){
+            Request request = {DEPOSIT, (uint32_t)account, account, 0, PREFUND_CENTS, clientId};
+            if(!sendRequest(clientSocket, &request)) break;
+            inFlight++;
+        }
+        if(inFlight == PIPELINE_DEPTH || (account >= options->accounts && inFlight > 0)){
+            Response response;
+            if(!receiveResponse(clientSocket, &response)) break;
+            inFlight--;
+        }
+    }
+
     close(clientSocket);
+    return inFlight == 0;
+}
+
+void printLoadReport(const LoadOptions* options, LoadWorker* workers){
+    Histogram* merged = calloc(1, sizeof(Histogram));
+    uint64_t sent = 0, completed = 0, failed = 0, busy = 0, timedOut = 0, hedged = 0;
+    if(!merged) return;
+
+    for(int index = 0; index < options->threads; index++){
+        LoadWorker* worker = &workers[index];
+        sent += worker->sent;
+        completed += worker->completed;
+        failed += worker->failed;
+        busy += worker->busy;
+        timedOut += worker->timedOut;
+        hedged += worker->hedged;
+        for(int bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++){
+            merged->counts[bucket] += worker->histogram.counts[bucket];
+        }
+        merged->total += worker->histogram.total;
+        if(worker->histogram.max > merged->max) merged->max = worker->histogram.max;
+    }
+
+    printf("\n============================================\n");
+    printf("Load: %d connection(s) on %d thread(s), target %.0f req/s for %d s\n",
+           options->connections, options->threads, options->rate, options->duration);
+    printf("Sent: %llu  Completed: %llu  Failed: %llu  Busy: %llu  Timed out: %llu\n",
+           (unsigned long long)sent, (unsigned long long)completed, (unsigned long long)failed,
+           (unsigned long long)busy, (unsigned long long)timedOut);
+    if(options->hedgeNanos > 0){
+        printf("Hedged: %llu after %.0f us\n", (unsigned long long)hedged, options->hedgeNanos / 1000.0);
+    }
+    printf("Throughput: %.0f req/s\n", completed / (double)options->duration);
+
+    if(merged->total > 0){
+        static const double percentiles[] = {50, 90, 99, 99.9, 99.99, 100};
+        printf("Latency (us):");
+        for(size_t index = 0; index < sizeof(percentiles) / sizeof(percentiles[0]); index++){
+            printf("  p%g=%.1f", percentiles[index], histogramPercentile(merged, percentiles[index]) / 1000.0);
+        }
+        printf("\n");
+    }
+    printf("============================================\n");
+    free(merged);
+}
+
+void runLoad(const LoadOptions* options){
+    LoadWorker* workers = calloc(options->threads, sizeof(LoadWorker));
+    int* sockets = calloc(options->connections, sizeof(int));
+    int opened = 0;
+
+    if(!workers || !sockets){
+        printf("Error: Out of memory.\n");
+        free(workers);
+        free(sockets);
+        return;
+    }
+
+    if(!prefundAccounts(options)){
+        printf("Error: Connection failed. Make sure server is running.\n");
+        free(workers);
+        free(sockets);
+        return;
+    }
+
+    for(; opened < options->connections; opened++){
+        sockets[opened] = openLoadConnection();
+        if(sockets[opened] == -1){
+            printf("Error: Could only open %d of %d connections.\n", opened, options->connections);
+            break;
+        }
+    }
+
+    int started = 0;
+    if(opened == options->connections){
+        int base = 0;
+        for(; started < options->threads; started++){
+            LoadWorker* worker = &workers[started];
+            worker->options = options;
+            worker->threadNumber = started;
+            worker->connectionCount = options->connections / options->threads
+                + (started < options->connections % options->threads);
+            worker->sockets = sockets + base;
+            worker->inboxes = malloc((size_t)worker->connectionCount * BUFFER_SIZE);
+            worker->inboxLengths = calloc(worker->connectionCount, sizeof(size_t));
+            worker->sendTimes = malloc(LOAD_SLOTS * sizeof(uint64_t));
+            worker->requests = calloc(LOAD_SLOTS, sizeof(Request));
+            worker->sentOn = malloc(LOAD_SLOTS * sizeof(int));
+            worker->answered = malloc(LOAD_SLOTS);
+            if(worker->answered) memset(worker->answered, 1, LOAD_SLOTS);
+            worker->clientId = clientId + started + 1;
+            base += worker->connectionCount;
+
+            if(!worker->inboxes || !worker->inboxLengths || !worker->sendTimes
+               || !worker->requests || !worker->sentOn || !worker->answered
+               || pthread_create(&worker->thread, NULL, runLoadWorker, worker) != 0){
+                printf("Error: Cannot start load thread %d.\n", started);
+                free(worker->inboxes);
+                free(worker->inboxLengths);
+                free(worker->sendTimes);
+                free(worker->requests);
+                free(worker->sentOn);
+                free(worker->answered);
+                break;
+            }
+        }
+    }
+
+    for(int index = 0; index < started; index++){
+        pthread_join(workers[index].thread, NULL);
+        free(workers[index].inboxes);
+        free(workers[index].inboxLengths);
+        free(workers[index].sendTimes);
+        free(workers[index].requests);
+        free(workers[index].sentOn);
+        free(workers[index].answered);
+    }
+    if(started == options->threads){
+        printLoadReport(options, workers);
+    }
+
+    for(int index = 0; index < opened; index++){
+        close(sockets[index]);
+    }
+    free(sockets);
+    free(workers);
+}
+
+int parseLoadOptions(int argc, char* argv[], LoadOptions* options){
+    options->connections = 16;
+    options->threads = 4;
+    options->rate = 10000;
+    options->duration = 10;
+    options->accounts = 100;
+    options->withdrawWeight = 40;
+    options->depositWeight = 40;
+    options->balanceWeight = 20;
+    options->hedgeNanos = 0;
+
+    for(int index = 2; index < argc; index++){
+        if(index + 1 >= argc) return 0;
+        const char* option = argv[index];
+        const char* value = argv[++index];
+
+        if(strcmp(option, "--connections") == 0){
+            options->connections = atoi(value);
+        }
+        else if(strcmp(option, "--threads") == 0){
+            options->threads = atoi(value);
+        }
+        else if(strcmp(option, "--rate") == 0){
+            options->rate = atof(value);
+        }
+        else if(strcmp(option, "--duration") == 0){
+            options->duration = atoi(value);
+        }
+        else if(strcmp(option, "--accounts") == 0){
+            options->accounts = atoi(value);
+        }
+        else if(strcmp(option, "--hedge-us") == 0){
+            options->hedgeNanos = (uint64_t)(atof(value) * 1000);
+        }
+        else if(strcmp(option, "--mix") == 0){
+            if(sscanf(value, "%d:%d:%d", &options->withdrawWeight, &options->depositWeight, &options->balanceWeight) != 3){
+                return 0;
+            }
+        }
+        else{
+            return 0;
+        }
+    }
+
+    return options->threads >= 1 && options->threads <= MAX_LOAD_THREADS
+        && options->connections >= options->threads && options->rate > 0
+        && options->duration > 0 && options->accounts > 0
+        && options->withdrawWeight >= 0 && options->depositWeight >= 0 && options->balanceWeight >= 0
+        && options->withdrawWeight + options->depositWeight + options->balanceWeight > 0;
 }
 
-int main(){
-    initiateClient();
+// Names this run of the client to the server's reply history. Zero would
+// opt out of it, so it is never used.
+uint64_t newClientId(){
+    uint64_t id = monotonicNanos() ^ ((uint64_t)time(NULL) << 32) ^ ((uint64_t)getpid() << 16);
+    id *= 0x9E3779B97F4A7C15ull;
+    return id ? id : 1;
+}
+
+void printUsage(const char* program){
+    printf("Usage: %s [--batch | --stats]\n", program);
+    printf("       %s --load [--connections N] [--threads M] [--rate REQ_PER_SEC]\n", program);
+    printf("          [--duration SECONDS] [--accounts K] [--mix WITHDRAW:DEPOSIT:BALANCE]\n");
+    printf("          [--hedge-us MICROSECONDS]\n");
+}
+
+int main(int argc, char* argv[]){
+    LoadOptions options;
+
+    clientId = newClientId();
+
+    if(argc == 2 && strcmp(argv[1], "--batch") == 0){
+        runBatch();
+    }
+    else if(argc == 2 && strcmp(argv[1], "--stats") == 0){
+        runStats();
+    }
+    else if(argc >= 2 && strcmp(argv[1], "--load") == 0){
+        if(!parseLoadOptions(argc, argv, &options)){
+            printUsage(argv[0]);
+            return 1;
+        }
+        runLoad(&options);
+    }
+    else if(argc == 1){
+        initiateClient();
+    }
+    else{
+        printUsage(argv[0]);
+        return 1;
+    }
     return 0;
 }
\ No newline at end of file
@@ -1,206 +1,2876 @@
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <sched.h>
 #include <pthread.h>
+#include <semaphore.h>
 #include <arpa/inet.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#ifdef USE_IO_URING
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+#endif
 
 #define PORT 8080
 #define BUFFER_SIZE 1024
-#define ACCOUNT_FILE "resource/accountDB.txt"
+#define DEFAULT_DATA_DIR "resource"
+#define ACCOUNT_FILE "accountDB.txt"
+#define CHECKPOINT_FILE "accountDB.txt.tmp"
+#define LEDGER_LOG_FILE "accountDB.wal"
+#define DATA_PATH_SIZE 512
+#define CHECKPOINT_RECORDS 4096
+#define CHECKPOINT_SECONDS 5
+#define ACCOUNT_BUCKETS 65536
+#define ACCOUNT_STRIPES 256
+#define DEFAULT_ACCOUNT 1
+#define DEFAULT_BALANCE 1000000
+#define MAX_EVENTS 256
+#define MAX_EVENT_LOOPS 64
+#define MAX_WORKERS 256
+#define DEFAULT_MAX_IN_FLIGHT 4096
+#define DEDUP_WINDOW 1024
+#define DEDUP_SEEN_IDS 65536
+#define DEDUP_SECONDS 30
+#define DEDUP_CLIENTS 1024
+#define DEDUP_STRIPES 256
+#define SETTLEMENT_PENDING 0
+#define SETTLEMENT_DONE 1
+#define SETTLEMENT_SLEEPING 2
+#define SETTLEMENT_SPINS 64
+#define DEDUP_EMPTY 0
+#define DEDUP_RUNNING 1
+#define DEDUP_DONE 2
+#define LOG_RING_SIZE 8192
+#define LOG_LINE_SIZE 160
+#define HISTOGRAM_SUB_BITS 5
+#define HISTOGRAM_BUCKETS (48 << HISTOGRAM_SUB_BITS)
 
 #define WITHDRAW 1
 #define DEPOSIT 2
 #define BALANCE 3
-#define EXIT 4
+#define TRANSFER 4
+#define EXIT 5
+#define STATS 6
+#define OPERATION_SLOTS 5
 
-pthread_mutex_t fileMutex = PTHREAD_MUTEX_INITIALIZER;
+// Every frame is a 4-byte big-endian length followed by the body. Requests
+// are op, pad[3], request id, account, target, amount in cents, client id;
+// responses are op, status, pad[2], request id, account, amount, balance.
+#define FRAME_HEADER_SIZE 4
+#define REQUEST_SIZE 36
+#define RESPONSE_SIZE 32
+#define STATS_HEADER_SIZE 24
+#define STATS_OPERATION_SIZE 64
+#define STATS_RESPONSE_SIZE (STATS_HEADER_SIZE + (OPERATION_SLOTS - 1) * STATS_OPERATION_SIZE)
+
+#define STATUS_OK 0
+#define STATUS_INSUFFICIENT_FUNDS 1
+#define STATUS_INVALID_AMOUNT 2
+#define STATUS_UNKNOWN_ACCOUNT 3
+#define STATUS_SAME_ACCOUNT 4
+#define STATUS_INVALID_OPERATION 5
+#define STATUS_BUSY 6
+#define STATUS_EXPIRED 7
+#define STATUS_ID_REUSED 8
+
+// Built with -DUSE_IO_URING, --io-uring moves the event loops and the
+// ledger log onto io_uring. The low bits of a connection's or loop's
+// address in user_data say which operation completed.
+#ifdef USE_IO_URING
+#define RING_ENTRIES 1024
+#define RING_RECV_BUFFERS 1024
+#define RING_RECV_GROUP 0
+#define RING_ACCEPT 0
+#define RING_WAKE 1
+#define RING_RECV 2
+#define RING_SEND 3
+#define RING_KIND_MASK 3
+#define IO_URING_USAGE " [--io-uring]"
+#else
+#define IO_URING_USAGE ""
+#endif
+
+// A deposit (positive amount) or withdrawal (negative) waiting to be
+// applied by whichever thread next holds the account lock. It lives on the
+// requesting thread's stack until state reaches SETTLEMENT_DONE; a
+// requester that goes to sleep on the futex marks it SETTLEMENT_SLEEPING
+// so the applier knows to wake it.
+typedef struct Settlement
+{
+    int64_t amount;
+    uint8_t status;
+    int64_t balance;
+    unsigned long long seq;
+    atomic_int state;
+    struct Settlement *next;
+} Settlement;
+
+// Accounts are never removed, so a published account and its place in a
+// bucket chain stay valid for the life of the server. Balances are in
+// cents and are read and decided on under the account's own lock.
+typedef struct Account
+{
+    int id;
+    int64_t balance;
+    unsigned long long seq;
+    pthread_mutex_t lock;
+    _Atomic(struct Settlement *) settlements;
+    struct Account *next;
+} Account;
+
+// Lookups walk the bucket chains without locking; inserts are serialized
+// per stripe of buckets and publish the new head with release ordering.
+typedef struct
+{
+    _Atomic(Account *) buckets[ACCOUNT_BUCKETS];
+    pthread_mutex_t stripes[ACCOUNT_STRIPES];
+} AccountTable;
+
+// Balances live in memory. Every change is appended to the log as a
+// numbered record; the committer thread writes and fsyncs whatever has
+// accumulated in one go and publishes the highest durable record. Balances
+// are only assigned while the log mutex is held, which is what lets the
+// committer take a consistent checkpoint.
+typedef struct
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t recordsPending;
+    int logFd;
+    char *pending;
+    size_t pendingLength;
+    size_t pendingCapacity;
+    unsigned long long appendedSeq;
+    atomic_ullong durableSeq;
+#ifdef USE_IO_URING
+    struct Ring *ring;
+#endif
+} Ledger;
+
+typedef struct
+{
+    uint8_t operation;
+    uint32_t requestId;
+    int32_t account;
+    int32_t target;
+    int64_t amount;
+    uint64_t clientId;
+} Request;
+
+typedef struct
+{
+    uint8_t operation;
+    uint8_t status;
+    uint32_t requestId;
+    int32_t account;
+    int64_t amount;
+    int64_t balance;
+} Response;
+
+// The request is kept alongside its reply so a reused id carrying a
+// different request can be told apart from a retry. Copies that arrive
+// while the first is running wait in waiters.
+typedef struct
+{
+    uint32_t requestId;
+    uint8_t state;
+    uint8_t operation;
+    int32_t account;
+    int32_t target;
+    int64_t amount;
+    uint64_t finishedAt;
+    Response response;
+    unsigned long long seq;
+    struct WorkItem *waiters;
+} DedupEntry;
+
+// The replies recently given to one client, in slots picked by request id
+// modulo DEDUP_WINDOW. Requests from several connections and workers land
+// out of order, so which ids have run is tracked separately, one bit each
+// for the DEDUP_SEEN_IDS ids up to newestId: an id whose bit is clear has
+// never run, however far behind newestId it is, while one whose bit is set
+// but whose reply slot has since been taken is answered as expired, no
+// sooner than the newest evicted reply is released. Ids older than the
+// bitmap are expired too. A history that has sat idle for DEDUP_SECONDS is
+// handed to the next new client in its stripe, and once the table holds its
+// limit of clients so is the least recently used one with nothing running.
+typedef struct ClientHistory
+{
+    uint64_t clientId;
+    uint64_t lastUsed;
+    uint32_t newestId;
+    bool seenId;
+    int running;
+    unsigned long long evictedSeq;
+    struct ClientHistory *next;
+    uint64_t seen[DEDUP_SEEN_IDS / 64];
+    DedupEntry entries[DEDUP_WINDOW];
+} ClientHistory;
+
+// What is left of a history evicted before DEDUP_SECONDS were up. If the
+// client comes back, every id up to newestId is treated as seen, so its
+// old retries are expired instead of run a second time.
+typedef struct
+{
+    uint64_t clientId;
+    uint32_t newestId;
+    unsigned long long evictedSeq;
+    uint64_t evictedAt;
+} DedupTombstone;
+
+typedef struct
+{
+    pthread_mutex_t mutex;
+    ClientHistory *clients;
+    DedupTombstone *tombstones;
+    int tombstoneCount;
+    int tombstoneCapacity;
+} DedupStripe;
+
+typedef struct
+{
+    DedupStripe stripes[DEDUP_STRIPES];
+    atomic_int clientCount;
+    int clientLimit;
+} DedupTable;
+
+// A reply queued in output but not yet released to the socket, kept so
+// its latency can be recorded once the group commit lets it go.
+typedef struct
+{
+    uint8_t operation;
+    uint8_t status;
+    uint64_t receivedAt;
+} HeldReply;
+
+// Per-connection state for the event loops. Requests are read into input
+// and replies queued in output until the socket accepts them. Replies are
+// held back until the log is durable up to waitSeq.
+typedef struct Connection
+{
+    int clientSocket;
+    int clientNumber;
+    unsigned char input[BUFFER_SIZE];
+    size_t inputLength;
+    unsigned char *output;
+    size_t outputLength;
+    size_t outputSent;
+    size_t outputCapacity;
+    bool closing;
+    bool failed;
+    bool closed;
+    int inFlight;
+    unsigned long long waitSeq;
+    bool waiting;
+    struct Connection *waitNext;
+    struct Connection *waitPrev;
+    HeldReply *held;
+    size_t heldCount;
+    size_t heldCapacity;
+#ifdef USE_IO_URING
+    unsigned char *sendBuffer;
+    size_t sendCapacity;
+    size_t sendLength;
+    size_t sendOffset;
+    int ringPending;
+    bool shutDown;
+#endif
+} Connection;
+
+typedef struct
+{
+    atomic_size_t sequence;
+    char text[LOG_LINE_SIZE];
+} LogSlot;
+
+// Lines are formatted straight into a ring slot by the thread logging them
+// and written out by the logger thread. A full ring drops the line rather
+// than make a request wait on stdout. An idle logger blocks on wakeFd and
+// the first line published after it says so writes to it.
+typedef struct
+{
+    LogSlot *slots;
+    size_t mask;
+    int wakeFd;
+    _Alignas(64) atomic_size_t enqueuePos;
+    atomic_bool sleeping;
+    _Alignas(64) size_t dequeuePos;
+    atomic_ullong dropped;
+} AsyncLogger;
+
+// Counters for one operation as seen by one event loop. Latency runs from
+// receipt until the reply is released to the socket, so it includes the
+// wait for the group commit. Only the owning loop writes them; STATS readers on other loops sum them with relaxed
+// loads, so the totals may trail by a request or two.
+typedef struct
+{
+    atomic_ullong requests;
+    atomic_ullong errors;
+    atomic_ullong busy;
+    atomic_ullong maxLatency;
+    atomic_ullong latencies[HISTOGRAM_BUCKETS];
+} OperationStats;
+
+typedef struct
+{
+    atomic_size_t sequence;
+    void *data;
+} QueueCell;
+
+// Bounded multi-producer multi-consumer queue (Vyukov). Each cell's
+// sequence says whose turn it is, so producers and consumers only contend
+// on their own position counter.
+typedef struct
+{
+    QueueCell *cells;
+    size_t mask;
+    _Alignas(64) atomic_size_t enqueuePos;
+    _Alignas(64) atomic_size_t dequeuePos;
+} BoundedQueue;
+
+#ifdef USE_IO_URING
+// Submission and completion queues shared with the kernel. Entries are
+// filled in at localTail and only published when the ring is entered, so
+// everything queued in between goes to the kernel in one io_uring_enter.
+// Receives pick their buffer from recvRing, which is registered with the
+// kernel as buffer group RING_RECV_GROUP.
+typedef struct Ring
+{
+    int ringFd;
+    unsigned entries;
+    unsigned char *rings;
+    size_t ringsSize;
+    size_t sqesSize;
+    atomic_uint *sqHead;
+    atomic_uint *sqTail;
+    unsigned sqMask;
+    unsigned localTail;
+    struct io_uring_sqe *sqes;
+    atomic_uint *cqHead;
+    atomic_uint *cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe *cqes;
+    struct io_uring_buf_ring *recvRing;
+    unsigned char *recvBuffers;
+    unsigned short recvTail;
+    uint64_t wakeValue;
+} Ring;
+#endif
+
+typedef struct
+{
+    int epollFd;
+    int serverSocket;
+    int wakeFd;
+    int loopNumber;
+    Connection *waiting;
+    Connection *closed;
+    BoundedQueue completions;
+    atomic_bool wakePending;
+    OperationStats *stats;
+#ifdef USE_IO_URING
+    Ring *ring;
+#endif
+} EventLoop;
+
+// A request travelling from an event loop to a worker and back. The pool
+// holds exactly maxInFlight of them; running out is what triggers BUSY.
+// next links the copies parked on a running request's history entry.
+typedef struct WorkItem
+{
+    EventLoop *loop;
+    Connection *connection;
+    Request request;
+    Response response;
+    unsigned long long seq;
+    uint64_t receivedAt;
+    struct WorkItem *next;
+} WorkItem;
+
+typedef struct
+{
+    WorkItem *items;
+    BoundedQueue freeItems;
+    BoundedQueue pending;
+    sem_t pendingCount;
+} WorkerPool;
 
 typedef struct
 {
-    int clientSocket;
-    int clientNumber;
-} ClientInfo;
+    int loopCount;
+    bool reusePort;
+    int workerCount;
+    int maxInFlight;
+    int dedupClients;
+    bool ioUring;
+    const char *dataDir;
+} ServerOptions;
+
+// Full paths of the data files, filled in from --data-dir at startup.
+typedef struct
+{
+    char dataDir[DATA_PATH_SIZE];
+    char accountFile[DATA_PATH_SIZE];
+    char checkpointFile[DATA_PATH_SIZE];
+    char ledgerLogFile[DATA_PATH_SIZE];
+} DataPaths;
+
+AccountTable accounts;
+Ledger ledger = {.mutex = PTHREAD_MUTEX_INITIALIZER, .recordsPending = PTHREAD_COND_INITIALIZER, .logFd = -1};
+DedupTable dedup;
+atomic_int clientCounter = 0;
+EventLoop eventLoops[MAX_EVENT_LOOPS];
+WorkerPool workerPool;
+AsyncLogger logger;
+int eventLoopCount = 0;
+DataPaths dataPaths;
+
+void logMessage(const char *format, ...)
+{
+    LogSlot *slot;
+    size_t position = atomic_load_explicit(&logger.enqueuePos, memory_order_relaxed);
+
+    while (1)
+    {
+        slot = &logger.slots[position & logger.mask];
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+
+        if (difference == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&logger.enqueuePos, &position, position + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if (difference < 0)
+        {
+            atomic_fetch_add_explicit(&logger.dropped, 1, memory_order_relaxed);
+            return;
+        }
+        else
+        {
+            position = atomic_load_explicit(&logger.enqueuePos, memory_order_relaxed);
+        }
+    }
+
+    va_list arguments;
+    va_start(arguments, format);
+    vsnprintf(slot->text, LOG_LINE_SIZE, format, arguments);
+    va_end(arguments);
+    atomic_store_explicit(&slot->sequence, position + 1, memory_order_release);
+
+    // Pairs with the logger storing sleeping and then re-reading the slot:
+    // either it sees this line or this thread sees it asleep.
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&logger.sleeping, memory_order_relaxed) && atomic_exchange(&logger.sleeping, false))
+    {
+        // A failed write cannot be logged; the logger's error path polls.
+        unsigned long long one = 1;
+        ssize_t written = write(logger.wakeFd, &one, sizeof(one));
+        (void)written;
+    }
+}
+
+void *runLogger(void *arg)
+{
+    (void)arg;
+    unsigned long long reportedDrops = 0;
+
+    while (1)
+    {
+        LogSlot *slot = &logger.slots[logger.dequeuePos & logger.mask];
+        if (atomic_load_explicit(&slot->sequence, memory_order_acquire) == logger.dequeuePos + 1)
+        {
+            fputs(slot->text, stdout);
+            atomic_store_explicit(&slot->sequence, logger.dequeuePos + logger.mask + 1, memory_order_release);
+            logger.dequeuePos++;
+            continue;
+        }
+
+        unsigned long long dropped = atomic_load_explicit(&logger.dropped, memory_order_relaxed);
+        if (dropped != reportedDrops)
+        {
+            printf("[Logger] %llu line(s) dropped.\n", dropped - reportedDrops);
+            reportedDrops = dropped;
+        }
+        fflush(stdout);
+
+        atomic_store(&logger.sleeping, true);
+        if (atomic_load(&slot->sequence) == logger.dequeuePos + 1)
+        {
+            atomic_store(&logger.sleeping, false);
+            continue;
+        }
+        unsigned long long wakeups;
+        if (read(logger.wakeFd, &wakeups, sizeof(wakeups)) < 0 && errno != EINTR)
+        {
+            struct timespec pause = {0, 1000000};
+            nanosleep(&pause, NULL);
+        }
+    }
+
+    return NULL;
+}
+
+bool startLogger()
+{
+    logger.slots = malloc(LOG_RING_SIZE * sizeof(LogSlot));
+    if (!logger.slots)
+        return false;
+
+    for (size_t index = 0; index < LOG_RING_SIZE; index++)
+    {
+        atomic_init(&logger.slots[index].sequence, index);
+    }
+    logger.mask = LOG_RING_SIZE - 1;
+    atomic_init(&logger.sleeping, false);
+    logger.wakeFd = eventfd(0, EFD_CLOEXEC);
+    if (logger.wakeFd < 0)
+        return false;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, runLogger, NULL) != 0)
+        return false;
+    pthread_detach(thread);
+    return true;
+}
+
+uint64_t monotonicNanos()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+// Log-linear buckets: exact below 64ns, then 32 buckets per power of two.
+int histogramIndex(uint64_t value)
+{
+    if (value < (2u << HISTOGRAM_SUB_BITS))
+        return (int)value;
+
+    int shift = 63 - __builtin_clzll(value) - HISTOGRAM_SUB_BITS;
+    int index = ((shift + 1) << HISTOGRAM_SUB_BITS) + (int)((value >> shift) - (1u << HISTOGRAM_SUB_BITS));
+    return index < HISTOGRAM_BUCKETS ? index : HISTOGRAM_BUCKETS - 1;
+}
+
+uint64_t histogramValue(int index)
+{
+    if (index < (2 << HISTOGRAM_SUB_BITS))
+        return index;
+
+    int shift = (index >> HISTOGRAM_SUB_BITS) - 1;
+    uint64_t subBucket = (index & ((1 << HISTOGRAM_SUB_BITS) - 1)) + (1u << HISTOGRAM_SUB_BITS);
+    return ((subBucket + 1) << shift) - 1;
+}
+
+void bumpCounter(atomic_ullong *counter, unsigned long long amount)
+{
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + amount, memory_order_relaxed);
+}
+
+int operationSlot(uint8_t operation)
+{
+    return operation >= WITHDRAW && operation <= TRANSFER ? operation : 0;
+}
+
+void recordCompletion(EventLoop *loop, const HeldReply *reply, uint64_t now)
+{
+    OperationStats *stats = &loop->stats[operationSlot(reply->operation)];
+    uint64_t latency = now - reply->receivedAt;
+
+    bumpCounter(&stats->requests, 1);
+    if (reply->status != STATUS_OK)
+    {
+        bumpCounter(&stats->errors, 1);
+    }
+    bumpCounter(&stats->latencies[histogramIndex(latency)], 1);
+    if (latency > atomic_load_explicit(&stats->maxLatency, memory_order_relaxed))
+    {
+        atomic_store_explicit(&stats->maxLatency, latency, memory_order_relaxed);
+    }
+}
+
+bool initBoundedQueue(BoundedQueue *queue, size_t minimumCapacity)
+{
+    size_t capacity = 2;
+    while (capacity < minimumCapacity)
+    {
+        capacity *= 2;
+    }
+
+    queue->cells = malloc(capacity * sizeof(QueueCell));
+    if (!queue->cells)
+        return false;
+
+    for (size_t index = 0; index < capacity; index++)
+    {
+        atomic_init(&queue->cells[index].sequence, index);
+    }
+    queue->mask = capacity - 1;
+    atomic_init(&queue->enqueuePos, 0);
+    atomic_init(&queue->dequeuePos, 0);
+    return true;
+}
+
+bool pushBoundedQueue(BoundedQueue *queue, void *data)
+{
+    QueueCell *cell;
+    size_t position = atomic_load_explicit(&queue->enqueuePos, memory_order_relaxed);
+
+    while (1)
+    {
+        cell = &queue->cells[position & queue->mask];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+
+        if (difference == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&queue->enqueuePos, &position, position + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if (difference < 0)
+        {
+            return false;
+        }
+        else
+        {
+            position = atomic_load_explicit(&queue->enqueuePos, memory_order_relaxed);
+        }
+    }
+
+    cell->data = data;
+    atomic_store_explicit(&cell->sequence, position + 1, memory_order_release);
+    return true;
+}
+
+void *popBoundedQueue(BoundedQueue *queue)
+{
+    QueueCell *cell;
+    size_t position = atomic_load_explicit(&queue->dequeuePos, memory_order_relaxed);
+
+    while (1)
+    {
+        cell = &queue->cells[position & queue->mask];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+
+        if (difference == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&queue->dequeuePos, &position, position + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if (difference < 0)
+        {
+            return NULL;
+        }
+        else
+        {
+            position = atomic_load_explicit(&queue->dequeuePos, memory_order_relaxed);
+        }
+    }
+
+    void *data = cell->data;
+    atomic_store_explicit(&cell->sequence, position + queue->mask + 1, memory_order_release);
+    return data;
+}
+
+unsigned int accountBucket(int id)
+{
+    return ((unsigned int)id * 2654435769u) >> 16;
+}
+
+Account *findAccount(int id)
+{
+    Account *account = atomic_load_explicit(&accounts.buckets[accountBucket(id)], memory_order_acquire);
+    while (account && account->id != id)
+    {
+        account = account->next;
+    }
+    return account;
+}
+
+Account *findOrCreateAccount(int id)
+{
+    Account *account = findAccount(id);
+    if (account || id <= 0)
+        return account;
+
+    unsigned int bucket = accountBucket(id);
+    pthread_mutex_t *stripe = &accounts.stripes[bucket % ACCOUNT_STRIPES];
+    pthread_mutex_lock(stripe);
+
+    account = findAccount(id);
+    if (!account)
+    {
+        account = calloc(1, sizeof(Account));
+        if (account)
+        {
+            account->id = id;
+            pthread_mutex_init(&account->lock, NULL);
+            account->next = atomic_load_explicit(&accounts.buckets[bucket], memory_order_relaxed);
+            atomic_store_explicit(&accounts.buckets[bucket], account, memory_order_release);
+        }
+        else
+        {
+            logMessage("Error: Out of memory for account %d.\n", id);
+        }
+    }
+
+    pthread_mutex_unlock(stripe);
+    return account;
+}
+
+// Parses "[-]units[.cc]" into cents without going through floating point.
+bool parseCents(const char *text, int64_t *cents)
+{
+    bool negative = *text == '-';
+    int64_t value = 0;
+    int fraction = -1;
+
+    if (negative)
+        text++;
+    if (*text < '0' || *text > '9')
+        return false;
+
+    for (; *text && *text != '\n' && *text != '\r'; text++)
+    {
+        if (*text == '.' && fraction < 0)
+        {
+            fraction = 0;
+            continue;
+        }
+        if (*text < '0' || *text > '9' || fraction == 2 || value > (INT64_MAX - 9) / 10)
+            return false;
+        value = value * 10 + (*text - '0');
+        if (fraction >= 0)
+            fraction++;
+    }
+    for (int digits = fraction < 0 ? 0 : fraction; digits < 2; digits++)
+    {
+        if (value > INT64_MAX / 10)
+            return false;
+        value *= 10;
+    }
+
+    *cents = negative ? -value : value;
+    return true;
+}
+
+int formatCents(char *text, size_t size, int64_t cents)
+{
+    uint64_t magnitude = cents < 0 ? -(uint64_t)cents : (uint64_t)cents;
+    return snprintf(text, size, "%s%llu.%02llu", cents < 0 ? "-" : "",
+                    (unsigned long long)(magnitude / 100), (unsigned long long)(magnitude % 100));
+}
+
+void initAccountTable()
+{
+    for (int index = 0; index < ACCOUNT_STRIPES; index++)
+    {
+        pthread_mutex_init(&accounts.stripes[index], NULL);
+    }
+}
+
+// Each line of the account file is "account balance". A file holding just
+// a balance is the single-account format and belongs to DEFAULT_ACCOUNT.
+bool readAccounts()
+{
+    FILE *file = fopen(dataPaths.accountFile, "r");
+    if (!file)
+    {
+        printf("Error: Cannot open account file. Creating account %d with balance %d.%02d\n",
+               DEFAULT_ACCOUNT, DEFAULT_BALANCE / 100, DEFAULT_BALANCE % 100);
+        Account *account = findOrCreateAccount(DEFAULT_ACCOUNT);
+        if (!account)
+            return false;
+        account->balance = DEFAULT_BALANCE;
+        return true;
+    }
+
+    char line[BUFFER_SIZE];
+    while (fgets(line, sizeof(line), file))
+    {
+        char first[32], second[32];
+        int fields = sscanf(line, "%31s %31s", first, second);
+        int id = fields == 2 ? atoi(first) : DEFAULT_ACCOUNT;
+        int64_t balance = 0;
+
+        if (fields < 1)
+            continue;
+
+        Account *account = findOrCreateAccount(id);
+        if (!account || !parseCents(fields == 2 ? second : first, &balance))
+        {
+            printf("Error: Invalid account %s in account file.\n", first);
+            fclose(file);
+            return false;
+        }
+        account->balance = balance;
+    }
+
+    fclose(file);
+    return true;
+}
+
+// Checkpoints go to a temporary file that replaces the account file only
+// once it is on disk, so a crash leaves either the old or the new one.
+// A rename or a newly created file only survives a crash once the
+// directory holding it has been synced too.
+bool syncDataDirectory()
+{
+    int directory = open(dataPaths.dataDir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (directory < 0)
+        return false;
+    bool synced = fsync(directory) == 0;
+    close(directory);
+    return synced;
+}
+
+// The checkpoint is renamed into place and the directory synced before
+// the caller may truncate the ledger log, so a crash in between finds
+// either the old checkpoint with the full log or the new one.
+bool writeAccounts(const char *snapshot, size_t length)
+{
+    FILE *file = fopen(dataPaths.checkpointFile, "w");
+    if (!file)
+    {
+        logMessage("Error: Cannot write to account file.\n");
+        return false;
+    }
+    bool written = fwrite(snapshot, 1, length, file) == length && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    fclose(file);
+
+    if (!written || rename(dataPaths.checkpointFile, dataPaths.accountFile) != 0 || !syncDataDirectory())
+    {
+        logMessage("Error: Cannot write to account file.\n");
+        return false;
+    }
+    return true;
+}
+
+bool appendText(char **buffer, size_t *length, size_t *capacity, const char *text, size_t textLength)
+{
+    if (*length + textLength > *capacity)
+    {
+        size_t grownCapacity = *capacity ? *capacity : BUFFER_SIZE * 16;
+        while (grownCapacity < *length + textLength)
+        {
+            grownCapacity *= 2;
+        }
+        char *grown = realloc(*buffer, grownCapacity);
+        if (!grown)
+            return false;
+        *buffer = grown;
+        *capacity = grownCapacity;
+    }
+
+    memcpy(*buffer + *length, text, textLength);
+    *length += textLength;
+    return true;
+}
+
+// Called with ledger.mutex held, so no balance can change underneath.
+bool snapshotAccounts(char **snapshot, size_t *length, size_t *capacity)
+{
+    *length = 0;
+    for (int bucket = 0; bucket < ACCOUNT_BUCKETS; bucket++)
+    {
+        Account *account = atomic_load_explicit(&accounts.buckets[bucket], memory_order_acquire);
+        for (; account; account = account->next)
+        {
+            char line[64];
+            int lineLength = snprintf(line, sizeof(line), "%d ", account->id);
+            lineLength += formatCents(line + lineLength, sizeof(line) - lineLength, account->balance);
+            line[lineLength++] = '\n';
+            if (!appendText(snapshot, length, capacity, line, lineLength))
+            {
+                logMessage("Error: Out of memory for checkpoint.\n");
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool writeAll(int fd, const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t written = write(fd, data, length);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written <= 0)
+        {
+            return false;
+        }
+        data += written;
+        length -= written;
+    }
+    return true;
+}
+
+#ifdef USE_IO_URING
+// Sets a ring up with the raw system calls, so liburing is not needed.
+Ring *createRing(unsigned entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = entries * 4;
+
+    int ringFd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ringFd < 0)
+        return NULL;
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP))
+    {
+        close(ringFd);
+        return NULL;
+    }
+
+    size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    size_t ringSize = sqSize > cqSize ? sqSize : cqSize;
+    size_t sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    unsigned char *rings = mmap(NULL, ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    struct io_uring_sqe *sqes = mmap(NULL, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    Ring *ring = calloc(1, sizeof(Ring));
+    if (rings == MAP_FAILED || sqes == MAP_FAILED || !ring)
+    {
+        if (rings != MAP_FAILED)
+            munmap(rings, ringSize);
+        if (sqes != MAP_FAILED)
+            munmap(sqes, sqesSize);
+        free(ring);
+        close(ringFd);
+        return NULL;
+    }
+
+    ring->ringFd = ringFd;
+    ring->entries = params.sq_entries;
+    ring->rings = rings;
+    ring->ringsSize = ringSize;
+    ring->sqesSize = sqesSize;
+    ring->recvRing = MAP_FAILED;
+    ring->sqHead = (atomic_uint *)(rings + params.sq_off.head);
+    ring->sqTail = (atomic_uint *)(rings + params.sq_off.tail);
+    ring->sqMask = *(unsigned *)(rings + params.sq_off.ring_mask);
+    ring->sqes = sqes;
+    ring->cqHead = (atomic_uint *)(rings + params.cq_off.head);
+    ring->cqTail = (atomic_uint *)(rings + params.cq_off.tail);
+    ring->cqMask = *(unsigned *)(rings + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(rings + params.cq_off.cqes);
+
+    unsigned *sqArray = (unsigned *)(rings + params.sq_off.array);
+    for (unsigned index = 0; index < params.sq_entries; index++)
+    {
+        sqArray[index] = index;
+    }
+    ring->localTail = atomic_load_explicit(ring->sqTail, memory_order_relaxed);
+    return ring;
+}
+
+// Releases everything createRing and setupRingLoop acquired.
+void destroyRing(Ring *ring)
+{
+    if (ring->recvRing != MAP_FAILED)
+        munmap(ring->recvRing, RING_RECV_BUFFERS * sizeof(struct io_uring_buf));
+    free(ring->recvBuffers);
+    munmap(ring->sqes, ring->sqesSize);
+    munmap(ring->rings, ring->ringsSize);
+    close(ring->ringFd);
+    free(ring);
+}
+
+// Publishes the queued entries and, with waitFor > 0, sleeps until that
+// many completions are available.
+int enterRing(Ring *ring, unsigned waitFor)
+{
+    atomic_store_explicit(ring->sqTail, ring->localTail, memory_order_release);
+    unsigned submit = ring->localTail - atomic_load_explicit(ring->sqHead, memory_order_acquire);
+    return syscall(__NR_io_uring_enter, ring->ringFd, submit, waitFor, waitFor > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+// Returns NULL if the queue is full and cannot be submitted, leaving the
+// caller to drop whatever needed the entry.
+struct io_uring_sqe *queueSqe(Ring *ring, uint8_t opcode, int fd, uint64_t userData)
+{
+    while (ring->localTail - atomic_load_explicit(ring->sqHead, memory_order_acquire) == ring->entries)
+    {
+        if (enterRing(ring, 0) < 0 && errno != EINTR && errno != EBUSY)
+        {
+            logMessage("Error: Cannot submit to io_uring: %s.\n", strerror(errno));
+            return NULL;
+        }
+    }
+
+    struct io_uring_sqe *sqe = &ring->sqes[ring->localTail & ring->sqMask];
+    ring->localTail++;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = userData;
+    return sqe;
+}
+
+// The write and the fdatasync go in as one linked pair, so a batch costs a
+// single io_uring_enter. A short write breaks the link and cancels the
+// sync, and the rest of the batch is then finished the ordinary way.
+bool appendLogThroughRing(Ring *ring, const char *data, size_t length)
+{
+    struct io_uring_sqe *sqe = queueSqe(ring, IORING_OP_WRITE, ledger.logFd, 0);
+    if (!sqe)
+        return writeAll(ledger.logFd, data, length) && fdatasync(ledger.logFd) == 0;
+    sqe->addr = (uintptr_t)data;
+    sqe->len = length;
+    sqe->off = (uint64_t)-1;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe = queueSqe(ring, IORING_OP_FSYNC, ledger.logFd, 1);
+    if (!sqe)
+    {
+        ring->localTail--;
+        return writeAll(ledger.logFd, data, length) && fdatasync(ledger.logFd) == 0;
+    }
+    sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+
+    int results[2] = {0, 0};
+    for (int reaped = 0; reaped < 2;)
+    {
+        unsigned head = atomic_load_explicit(ring->cqHead, memory_order_relaxed);
+        if (head == atomic_load_explicit(ring->cqTail, memory_order_acquire))
+        {
+            if (enterRing(ring, 1) < 0 && errno != EINTR)
+                return false;
+            continue;
+        }
+        struct io_uring_cqe *cqe = &ring->cqes[head & ring->cqMask];
+        results[cqe->user_data] = cqe->res;
+        atomic_store_explicit(ring->cqHead, head + 1, memory_order_release);
+        reaped++;
+    }
+
+    if (results[0] < 0)
+        return false;
+    if ((size_t)results[0] == length && results[1] == 0)
+        return true;
+    return writeAll(ledger.logFd, data + results[0], length - results[0]) && fdatasync(ledger.logFd) == 0;
+}
+#endif
+
+bool writeLedgerBatch(const char *batch, size_t length)
+{
+#ifdef USE_IO_URING
+    if (ledger.ring)
+        return appendLogThroughRing(ledger.ring, batch, length);
+#endif
+    return writeAll(ledger.logFd, batch, length) && fdatasync(ledger.logFd) == 0;
+}
+
+// Creates the data directory if it is missing and builds the file paths
+// in it.
+bool prepareDataDirectory(const char *dataDir)
+{
+    if (mkdir(dataDir, 0755) != 0 && errno != EEXIST)
+    {
+        printf("Error: Cannot create data directory %s: %s\n", dataDir, strerror(errno));
+        return false;
+    }
+
+    int lengths[4] = {
+        snprintf(dataPaths.dataDir, DATA_PATH_SIZE, "%s", dataDir),
+        snprintf(dataPaths.accountFile, DATA_PATH_SIZE, "%s/%s", dataDir, ACCOUNT_FILE),
+        snprintf(dataPaths.checkpointFile, DATA_PATH_SIZE, "%s/%s", dataDir, CHECKPOINT_FILE),
+        snprintf(dataPaths.ledgerLogFile, DATA_PATH_SIZE, "%s/%s", dataDir, LEDGER_LOG_FILE),
+    };
+    for (int index = 0; index < 4; index++)
+    {
+        if (lengths[index] < 0 || lengths[index] >= DATA_PATH_SIZE)
+        {
+            printf("Error: Data directory path is too long.\n");
+            return false;
+        }
+    }
+    return true;
+}
+
+// Empties the ledger log once a checkpoint covers it. The new length is
+// synced as well: if a crash lost it, the records appended afterwards
+// would be followed by the stale tail of the old log, and replay would
+// end on balances older than the ones just written.
+bool truncateLedgerLog()
+{
+    return ftruncate(ledger.logFd, 0) == 0 && fsync(ledger.logFd) == 0;
+}
+
+// Loads the last checkpoint and replays the log on top of it. Records hold
+// the resulting balances, so replaying in order lands on the last state
+// and a torn tail from a crash mid-write is ignored.
+bool openLedger()
+{
+    initAccountTable();
+    if (!readAccounts())
+        return false;
+
+    ledger.logFd = open(dataPaths.ledgerLogFile, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (ledger.logFd < 0)
+    {
+        printf("Error: Cannot open ledger log %s.\n", dataPaths.ledgerLogFile);
+        return false;
+    }
+
+    FILE *log = fdopen(dup(ledger.logFd), "r");
+    if (!log)
+    {
+        printf("Error: Cannot read ledger log %s.\n", dataPaths.ledgerLogFile);
+        return false;
+    }
+
+    char line[BUFFER_SIZE];
+    int replayed = 0;
+    while (fgets(line, sizeof(line), log))
+    {
+        unsigned long long seq = 0;
+        int ids[2];
+        long long balances[2];
+        int fields = sscanf(line, "%llu %d %lld %d %lld", &seq, &ids[0], &balances[0], &ids[1], &balances[1]);
+        if (!strchr(line, '\n') || (fields != 3 && fields != 5))
+            continue;
+
+        for (int index = 0; index < (fields - 1) / 2; index++)
+        {
+            Account *account = findOrCreateAccount(ids[index]);
+            if (account)
+            {
+                account->balance = balances[index];
+            }
+        }
+        replayed++;
+    }
+    fclose(log);
+
+    if (replayed > 0)
+    {
+        char *snapshot = NULL;
+        size_t length = 0, capacity = 0;
+        printf("Recovered %d ledger record(s).\n", replayed);
+        bool saved = snapshotAccounts(&snapshot, &length, &capacity) && writeAccounts(snapshot, length);
+        free(snapshot);
+        if (!saved)
+            return false;
+    }
+    if (!truncateLedgerLog() || !syncDataDirectory())
+    {
+        printf("Error: Cannot truncate ledger log.\n");
+        return false;
+    }
+
+    return true;
+}
+
+// Writes value in decimal without a terminator and returns its length.
+int formatUnsigned(char *out, unsigned long long value)
+{
+    char digits[20];
+    int count = 0;
+    do
+    {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+
+    for (int index = 0; index < count; index++)
+    {
+        out[index] = digits[count - 1 - index];
+    }
+    return count;
+}
+
+// Called with the locks of the affected accounts held. Applies the new
+// balances and queues one record for them, so a transfer is replayed as a
+// unit. Returns the sequence number the caller's reply has to wait for.
+unsigned long long appendLedgerRecord(Account *first, int64_t firstBalance, Account *second, int64_t secondBalance)
+{
+    char record[128];
+    char body[96];
+    int bodyLength;
+
+    // Only the sequence number depends on the ledger lock, so the rest of
+    // the record is formatted before taking it.
+    if (second)
+    {
+        bodyLength = snprintf(body, sizeof(body), " %d %lld %d %lld\n",
+                              first->id, (long long)firstBalance, second->id, (long long)secondBalance);
+    }
+    else
+    {
+        bodyLength = snprintf(body, sizeof(body), " %d %lld\n", first->id, (long long)firstBalance);
+    }
+
+    pthread_mutex_lock(&ledger.mutex);
+
+    unsigned long long seq = ledger.appendedSeq + 1;
+    int length = formatUnsigned(record, seq);
+    memcpy(record + length, body, bodyLength);
+    length += bodyLength;
+    if (second)
+    {
+        second->balance = secondBalance;
+        second->seq = seq;
+    }
+    first->balance = firstBalance;
+    first->seq = seq;
+
+    if (!appendText(&ledger.pending, &ledger.pendingLength, &ledger.pendingCapacity, record, length))
+    {
+        printf("Error: Out of memory for ledger log.\n");
+        exit(1);
+    }
+    ledger.appendedSeq = seq;
+    pthread_cond_signal(&ledger.recordsPending);
+
+    pthread_mutex_unlock(&ledger.mutex);
+    return seq;
+}
+
+void wakeEventLoop(EventLoop *loop)
+{
+    unsigned long long one = 1;
+    if (write(loop->wakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+    {
+        logMessage("Error: Cannot wake event loop %d.\n", loop->loopNumber);
+    }
+}
+
+void wakeEventLoops()
+{
+    for (int index = 0; index < eventLoopCount; index++)
+    {
+        wakeEventLoop(&eventLoops[index]);
+    }
+}
+
+// Group commit: while one batch is being fsynced, new records pile up in
+// the pending buffer and go out together with the next fsync. Every
+// CHECKPOINT_RECORDS records or CHECKPOINT_SECONDS the balances are copied
+// alongside the batch they match and written to the account file once the
+// batch is durable, after which the log can start over.
+void *runLedgerCommitter(void *arg)
+{
+    (void)arg;
+    char *batch = NULL;
+    size_t batchCapacity = 0;
+    char *snapshot = NULL;
+    size_t snapshotLength = 0, snapshotCapacity = 0;
+    unsigned long long checkpointSeq = 0;
+    time_t lastCheckpoint = time(NULL);
+
+    while (1)
+    {
+        pthread_mutex_lock(&ledger.mutex);
+        if (ledger.pendingLength == 0)
+        {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += 1;
+            pthread_cond_timedwait(&ledger.recordsPending, &ledger.mutex, &deadline);
+        }
+
+        char *records = ledger.pending;
+        size_t recordsLength = ledger.pendingLength;
+        size_t recordsCapacity = ledger.pendingCapacity;
+        ledger.pending = batch;
+        ledger.pendingCapacity = batchCapacity;
+        ledger.pendingLength = 0;
+        unsigned long long seq = ledger.appendedSeq;
+
+        time_t now = time(NULL);
+        bool checkpoint = seq > checkpointSeq
+            && (seq - checkpointSeq >= CHECKPOINT_RECORDS || now - lastCheckpoint >= CHECKPOINT_SECONDS)
+            && snapshotAccounts(&snapshot, &snapshotLength, &snapshotCapacity);
+        pthread_mutex_unlock(&ledger.mutex);
+
+        batch = records;
+        batchCapacity = recordsCapacity;
+
+        if (recordsLength > 0)
+        {
+            if (!writeLedgerBatch(batch, recordsLength))
+            {
+                printf("Error: Cannot write ledger log. Stopping server.\n");
+                exit(1);
+            }
+            atomic_store(&ledger.durableSeq, seq);
+            wakeEventLoops();
+        }
+
+        if (checkpoint)
+        {
+            if (writeAccounts(snapshot, snapshotLength) && truncateLedgerLog())
+            {
+                checkpointSeq = seq;
+            }
+            lastCheckpoint = now;
+        }
+    }
+
+    return NULL;
+}
+
+void putUint32(unsigned char *bytes, uint32_t value)
+{
+    bytes[0] = value >> 24;
+    bytes[1] = value >> 16;
+    bytes[2] = value >> 8;
+    bytes[3] = value;
+}
+
+void putUint64(unsigned char *bytes, uint64_t value)
+{
+    putUint32(bytes, value >> 32);
+    putUint32(bytes + 4, (uint32_t)value);
+}
+
+uint32_t getUint32(const unsigned char *bytes)
+{
+    return ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | bytes[3];
+}
+
+uint64_t getUint64(const unsigned char *bytes)
+{
+    return ((uint64_t)getUint32(bytes) << 32) | getUint32(bytes + 4);
+}
+
+void decodeRequest(const unsigned char *frame, Request *request)
+{
+    request->operation = frame[4];
+    request->requestId = getUint32(frame + 8);
+    request->account = (int32_t)getUint32(frame + 12);
+    request->target = (int32_t)getUint32(frame + 16);
+    request->amount = (int64_t)getUint64(frame + 20);
+    request->clientId = getUint64(frame + 28);
+}
+
+// Grows the output buffer as needed and returns room for size more bytes.
+unsigned char *reserveOutput(Connection *connection, size_t size)
+{
+    size_t needed = connection->outputLength + size;
+    if (needed > connection->outputCapacity)
+    {
+        size_t capacity = connection->outputCapacity ? connection->outputCapacity : BUFFER_SIZE;
+        while (capacity < needed)
+        {
+            capacity *= 2;
+        }
+        unsigned char *grown = realloc(connection->output, capacity);
+        if (!grown)
+        {
+            logMessage("Error: Out of memory for client %d.\n", connection->clientNumber);
+            connection->closing = true;
+            return NULL;
+        }
+        connection->output = grown;
+        connection->outputCapacity = capacity;
+    }
+
+    unsigned char *frame = connection->output + connection->outputLength;
+    connection->outputLength = needed;
+    return frame;
+}
+
+// A reply never overtakes the records it reports on: seq is the last
+// ledger record the reply has seen, durable or not.
+void queueResponse(Connection *connection, const Response *response, unsigned long long seq)
+{
+    if (seq > connection->waitSeq)
+    {
+        connection->waitSeq = seq;
+    }
+
+    unsigned char *frame = reserveOutput(connection, RESPONSE_SIZE);
+    if (!frame)
+        return;
+
+    putUint32(frame, RESPONSE_SIZE - FRAME_HEADER_SIZE);
+    frame[4] = response->operation;
+    frame[5] = response->status;
+    frame[6] = 0;
+    frame[7] = 0;
+    putUint32(frame + 8, response->requestId);
+    putUint32(frame + 12, (uint32_t)response->account);
+    putUint64(frame + 16, (uint64_t)response->amount);
+    putUint64(frame + 24, (uint64_t)response->balance);
+}
+
+uint64_t statsPercentile(const unsigned long long *counts, unsigned long long total, uint64_t max, double percentile)
+{
+    unsigned long long target = (unsigned long long)(total * percentile / 100.0 + 0.5);
+    unsigned long long seen = 0;
+
+    if (target == 0)
+        target = 1;
+    for (int index = 0; index < HISTOGRAM_BUCKETS; index++)
+    {
+        seen += counts[index];
+        if (seen >= target)
+        {
+            uint64_t value = histogramValue(index);
+            return value < max ? value : max;
+        }
+    }
+    return max;
+}
+
+// STATS replies carry, after the usual op/status/request id, the number of
+// dropped log lines and then for each operation from WITHDRAW to TRANSFER:
+// requests, errors, busy, p50, p90, p99, p99.9 and max latency in ns.
+void queueStatsResponse(Connection *connection, const Request *request)
+{
+    static const double percentiles[] = {50, 90, 99, 99.9};
+    unsigned long long *counts = malloc(HISTOGRAM_BUCKETS * sizeof(unsigned long long));
+    unsigned char *frame = counts ? reserveOutput(connection, STATS_RESPONSE_SIZE) : NULL;
+
+    if (!frame)
+    {
+        free(counts);
+        return;
+    }
+
+    memset(frame, 0, STATS_HEADER_SIZE);
+    putUint32(frame, STATS_RESPONSE_SIZE - FRAME_HEADER_SIZE);
+    frame[4] = STATS;
+    frame[5] = STATUS_OK;
+    putUint32(frame + 8, request->requestId);
+    putUint32(frame + 12, OPERATION_SLOTS - 1);
+    putUint64(frame + 16, atomic_load_explicit(&logger.dropped, memory_order_relaxed));
+
+    for (int operation = WITHDRAW; operation <= TRANSFER; operation++)
+    {
+        unsigned long long requests = 0, errors = 0, busy = 0, total = 0;
+        uint64_t max = 0;
+        memset(counts, 0, HISTOGRAM_BUCKETS * sizeof(unsigned long long));
+
+        for (int loopIndex = 0; loopIndex < eventLoopCount; loopIndex++)
+        {
+            OperationStats *stats = &eventLoops[loopIndex].stats[operation];
+            requests += atomic_load_explicit(&stats->requests, memory_order_relaxed);
+            errors += atomic_load_explicit(&stats->errors, memory_order_relaxed);
+            busy += atomic_load_explicit(&stats->busy, memory_order_relaxed);
+            uint64_t loopMax = atomic_load_explicit(&stats->maxLatency, memory_order_relaxed);
+            max = loopMax > max ? loopMax : max;
+            for (int index = 0; index < HISTOGRAM_BUCKETS; index++)
+            {
+                unsigned long long count = atomic_load_explicit(&stats->latencies[index], memory_order_relaxed);
+                counts[index] += count;
+                total += count;
+            }
+        }
+
+        unsigned char *fields = frame + STATS_HEADER_SIZE + (operation - WITHDRAW) * STATS_OPERATION_SIZE;
+        putUint64(fields, requests);
+        putUint64(fields + 8, errors);
+        putUint64(fields + 16, busy);
+        for (int index = 0; index < 4; index++)
+        {
+            putUint64(fields + 24 + index * 8, total ? statsPercentile(counts, total, max, percentiles[index]) : 0);
+        }
+        putUint64(fields + 56, max);
+    }
+
+    free(counts);
+}
+
+// Called with the account lock held. Applies every settlement queued so
+// far in arrival order and logs the resulting balance as one record, so a
+// burst of clients on a hot account costs one lock and one log append.
+void applySettlements(Account *account)
+{
+    Settlement *queued = atomic_exchange(&account->settlements, NULL);
+    Settlement *batch = NULL;
+    while (queued)
+    {
+        Settlement *next = queued->next;
+        queued->next = batch;
+        batch = queued;
+        queued = next;
+    }
+
+    int64_t balance = account->balance;
+    bool changed = false;
+    for (Settlement *settlement = batch; settlement; settlement = settlement->next)
+    {
+        if (settlement->amount < 0 && -settlement->amount > balance)
+        {
+            settlement->status = STATUS_INSUFFICIENT_FUNDS;
+        }
+        else if (settlement->amount > 0 && settlement->amount > INT64_MAX - balance)
+        {
+            settlement->status = STATUS_INVALID_AMOUNT;
+        }
+        else
+        {
+            balance += settlement->amount;
+            settlement->status = STATUS_OK;
+            changed = true;
+        }
+        settlement->balance = balance;
+    }
+
+    unsigned long long seq = changed ? appendLedgerRecord(account, balance, NULL, 0) : account->seq;
+
+    while (batch)
+    {
+        Settlement *next = batch->next;
+        batch->seq = seq;
+        if (atomic_exchange_explicit(&batch->state, SETTLEMENT_DONE, memory_order_release) == SETTLEMENT_SLEEPING)
+        {
+            syscall(SYS_futex, &batch->state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+        }
+        batch = next;
+    }
+}
+
+// Queues the settlement. The thread whose push finds the queue empty is the
+// combiner: it takes the account lock and applies everything queued by
+// then. Every later push lands above its settlement, so those threads never
+// touch the lock; they spin briefly and then sleep on their own state until
+// the combiner, or a balance or transfer draining the queue, marks it done.
+void settle(Account *account, Settlement *settlement)
+{
+    atomic_init(&settlement->state, SETTLEMENT_PENDING);
+    Settlement *head = atomic_load(&account->settlements);
+    do
+    {
+        settlement->next = head;
+    } while (!atomic_compare_exchange_weak(&account->settlements, &head, settlement));
+
+    // Once pushed, next belongs to whoever applies the batch, so the old
+    // head is judged from the local copy.
+    if (!head)
+    {
+        pthread_mutex_lock(&account->lock);
+        if (atomic_load_explicit(&settlement->state, memory_order_acquire) != SETTLEMENT_DONE)
+        {
+            applySettlements(account);
+        }
+        pthread_mutex_unlock(&account->lock);
+        return;
+    }
+
+    for (int spin = 0; spin < SETTLEMENT_SPINS; spin++)
+    {
+        if (atomic_load_explicit(&settlement->state, memory_order_acquire) == SETTLEMENT_DONE)
+            return;
+        sched_yield();
+    }
+    int expected = SETTLEMENT_PENDING;
+    atomic_compare_exchange_strong(&settlement->state, &expected, SETTLEMENT_SLEEPING);
+    while (atomic_load_explicit(&settlement->state, memory_order_acquire) != SETTLEMENT_DONE)
+    {
+        syscall(SYS_futex, &settlement->state, FUTEX_WAIT_PRIVATE, SETTLEMENT_SLEEPING, NULL, NULL, 0);
+    }
+}
+
+// Called with the account lock held by paths that read or change the
+// balance directly, so they see queued settlements and release their waiters.
+void drainSettlements(Account *account)
+{
+    if (atomic_load_explicit(&account->settlements, memory_order_relaxed))
+    {
+        applySettlements(account);
+    }
+}
+
+unsigned long long handleWithdraw(const Request *request, Response *response)
+{
+    if (request->amount <= 0)
+    {
+        response->status = STATUS_INVALID_AMOUNT;
+        return 0;
+    }
+
+    Account *account = findAccount(request->account);
+    if (!account)
+    {
+        response->status = STATUS_UNKNOWN_ACCOUNT;
+        return 0;
+    }
+
+    Settlement settlement = {.amount = -request->amount};
+    settle(account, &settlement);
+
+    response->status = settlement.status;
+    response->balance = settlement.balance;
+    return settlement.seq;
+}
+
+// Depositing into an account that does not exist yet opens it.
+unsigned long long handleDeposit(const Request *request, Response *response)
+{
+    if (request->amount <= 0)
+    {
+        response->status = STATUS_INVALID_AMOUNT;
+        return 0;
+    }
+
+    Account *account = findOrCreateAccount(request->account);
+    if (!account)
+    {
+        response->status = STATUS_UNKNOWN_ACCOUNT;
+        return 0;
+    }
+
+    Settlement settlement = {.amount = request->amount};
+    settle(account, &settlement);
+
+    response->status = settlement.status;
+    response->balance = settlement.balance;
+    return settlement.seq;
+}
+
+unsigned long long handleBalance(const Request *request, Response *response)
+{
+    Account *account = findAccount(request->account);
+    if (!account)
+    {
+        response->status = STATUS_UNKNOWN_ACCOUNT;
+        return 0;
+    }
+
+    pthread_mutex_lock(&account->lock);
+    drainSettlements(account);
+
+    int64_t currentBalance = account->balance;
+    unsigned long long seq = account->seq;
+
+    pthread_mutex_unlock(&account->lock);
+
+    response->balance = currentBalance;
+    return seq;
+}
+
+// Both account locks are taken in ascending id order, so two transfers in
+// opposite directions cannot deadlock.
+unsigned long long handleTransfer(const Request *request, Response *response)
+{
+    Account *from = findAccount(request->account);
+    Account *to = findAccount(request->target);
+
+    if (!from || !to)
+    {
+        response->status = STATUS_UNKNOWN_ACCOUNT;
+        return 0;
+    }
+    if (from == to)
+    {
+        response->status = STATUS_SAME_ACCOUNT;
+        return 0;
+    }
+
+    Account *lower = from->id < to->id ? from : to;
+    Account *upper = from->id < to->id ? to : from;
+    pthread_mutex_lock(&lower->lock);
+    pthread_mutex_lock(&upper->lock);
+    drainSettlements(from);
+    drainSettlements(to);
+
+    int64_t currentBalance = from->balance;
+    int64_t amount = request->amount;
+    unsigned long long seq = from->seq > to->seq ? from->seq : to->seq;
+
+    if (amount <= 0 || amount > INT64_MAX - to->balance)
+    {
+        response->status = STATUS_INVALID_AMOUNT;
+    }
+    else if (amount > currentBalance)
+    {
+        response->status = STATUS_INSUFFICIENT_FUNDS;
+    }
+    else
+    {
+        currentBalance -= amount;
+        seq = appendLedgerRecord(from, currentBalance, to, to->balance + amount);
+    }
+
+    pthread_mutex_unlock(&upper->lock);
+    pthread_mutex_unlock(&lower->lock);
+
+    response->balance = currentBalance;
+    return seq;
+}
+
+unsigned long long executeRequest(const Request *request, Response *response)
+{
+    response->operation = request->operation;
+    response->status = STATUS_OK;
+    response->requestId = request->requestId;
+    response->account = request->account;
+    response->amount = request->amount;
+    response->balance = 0;
+
+    if (request->operation == WITHDRAW)
+    {
+        return handleWithdraw(request, response);
+    }
+    else if (request->operation == DEPOSIT)
+    {
+        return handleDeposit(request, response);
+    }
+    else if (request->operation == BALANCE)
+    {
+        return handleBalance(request, response);
+    }
+    else if (request->operation == TRANSFER)
+    {
+        return handleTransfer(request, response);
+    }
+
+    response->status = STATUS_INVALID_OPERATION;
+    return 0;
+}
+
+void initDedupTable(int clientLimit)
+{
+    dedup.clientLimit = clientLimit;
+    for (int index = 0; index < DEDUP_STRIPES; index++)
+    {
+        pthread_mutex_init(&dedup.stripes[index].mutex, NULL);
+    }
+}
+
+// Called with the stripe locked, before an idle history is handed to
+// another client while its replies may still be asked for. Tombstones
+// older than DEDUP_SECONDS are dropped on the way. Returns false when
+// there is no room for the tombstone, in which case the history is kept.
+bool buryClientHistory(DedupStripe *stripe, const ClientHistory *history, uint64_t now)
+{
+    int kept = 0;
+    for (int index = 0; index < stripe->tombstoneCount; index++)
+    {
+        if (stripe->tombstones[index].evictedAt + DEDUP_SECONDS * 1000000000ull >= now)
+            stripe->tombstones[kept++] = stripe->tombstones[index];
+    }
+    stripe->tombstoneCount = kept;
+
+    if (stripe->tombstoneCount == stripe->tombstoneCapacity)
+    {
+        int capacity = stripe->tombstoneCapacity ? stripe->tombstoneCapacity * 2 : 8;
+        DedupTombstone *grown = realloc(stripe->tombstones, capacity * sizeof(DedupTombstone));
+        if (!grown)
+            return false;
+        stripe->tombstones = grown;
+        stripe->tombstoneCapacity = capacity;
+    }
+
+    DedupTombstone *tombstone = &stripe->tombstones[stripe->tombstoneCount++];
+    tombstone->clientId = history->clientId;
+    tombstone->newestId = history->newestId;
+    tombstone->evictedSeq = history->evictedSeq;
+    tombstone->evictedAt = now;
+    for (int index = 0; index < DEDUP_WINDOW; index++)
+    {
+        if (history->entries[index].state == DEDUP_DONE && history->entries[index].seq > tombstone->evictedSeq)
+            tombstone->evictedSeq = history->entries[index].seq;
+    }
+    return true;
+}
+
+// Called with the stripe locked. Empties history for clientId, restoring
+// what its tombstone remembers if the client was evicted recently.
+void claimClientHistory(DedupStripe *stripe, ClientHistory *history, uint64_t clientId, uint64_t now)
+{
+    memset(history->entries, 0, sizeof(history->entries));
+    memset(history->seen, 0, sizeof(history->seen));
+    history->clientId = clientId;
+    history->seenId = false;
+    history->evictedSeq = 0;
+
+    for (int index = 0; index < stripe->tombstoneCount; index++)
+    {
+        DedupTombstone *tombstone = &stripe->tombstones[index];
+        if (tombstone->clientId == clientId && tombstone->evictedAt + DEDUP_SECONDS * 1000000000ull >= now)
+        {
+            memset(history->seen, 0xFF, sizeof(history->seen));
+            history->newestId = tombstone->newestId;
+            history->seenId = true;
+            history->evictedSeq = tombstone->evictedSeq;
+            *tombstone = stripe->tombstones[--stripe->tombstoneCount];
+            break;
+        }
+    }
+}
+
+// Called with the stripe locked. The client limit is soft: past it an idle
+// history in this stripe is reused, and the table only grows beyond it
+// when every history here has requests running. Returns NULL only when a
+// new history cannot be allocated.
+ClientHistory *findClientHistory(DedupStripe *stripe, uint64_t clientId, uint64_t now)
+{
+    ClientHistory *expired = NULL;
+    ClientHistory *idle = NULL;
+    for (ClientHistory *history = stripe->clients; history; history = history->next)
+    {
+        if (history->clientId == clientId)
+            return history;
+        if (history->running != 0)
+            continue;
+        if (!expired && history->lastUsed + DEDUP_SECONDS * 1000000000ull < now)
+            expired = history;
+        if (!idle || history->lastUsed < idle->lastUsed)
+            idle = history;
+    }
+
+    if (!expired && idle && atomic_load(&dedup.clientCount) >= dedup.clientLimit
+        && buryClientHistory(stripe, idle, now))
+    {
+        expired = idle;
+    }
+    if (expired)
+    {
+        claimClientHistory(stripe, expired, clientId, now);
+        return expired;
+    }
+
+    ClientHistory *history = malloc(sizeof(ClientHistory));
+    if (!history)
+        return NULL;
+    atomic_fetch_add(&dedup.clientCount, 1);
+    history->lastUsed = now;
+    history->running = 0;
+    claimClientHistory(stripe, history, clientId, now);
+    history->next = stripe->clients;
+    stripe->clients = history;
+    return history;
+}
+
+bool idSeen(const ClientHistory *history, uint32_t requestId)
+{
+    uint32_t bit = requestId & (DEDUP_SEEN_IDS - 1);
+    return (history->seen[bit / 64] >> (bit % 64)) & 1;
+}
+
+void markIdSeen(ClientHistory *history, uint32_t requestId)
+{
+    uint32_t bit = requestId & (DEDUP_SEEN_IDS - 1);
+    history->seen[bit / 64] |= 1ull << (bit % 64);
+}
+
+// Moves newestId forward to requestId. The bits of the ids entering the
+// window still describe the ids DEDUP_SEEN_IDS before them, so they are
+// cleared on the way.
+void advanceNewestId(ClientHistory *history, uint32_t requestId)
+{
+    uint32_t distance = requestId - history->newestId;
+    if (distance >= DEDUP_SEEN_IDS)
+    {
+        memset(history->seen, 0, sizeof(history->seen));
+    }
+    else
+    {
+        for (uint32_t id = history->newestId + 1; id != requestId + 1; id++)
+        {
+            uint32_t bit = id & (DEDUP_SEEN_IDS - 1);
+            if ((bit % 64) == 0 && requestId - id >= 63)
+            {
+                history->seen[bit / 64] = 0;
+                id += 63;
+            }
+            else
+            {
+                history->seen[bit / 64] &= ~(1ull << (bit % 64));
+            }
+        }
+    }
+    history->newestId = requestId;
+}
+
+void rejectRequest(const Request *request, Response *response, uint8_t status)
+{
+    memset(response, 0, sizeof(*response));
+    response->operation = request->operation;
+    response->status = status;
+    response->requestId = request->requestId;
+    response->account = request->account;
+    response->amount = request->amount;
+}
+
+// Hands a finished item back to the loop that owns its connection. A loop
+// is only signalled when it is not already due to look at its completions.
+void completeWorkItem(WorkItem *item)
+{
+    EventLoop *loop = item->loop;
+    while (!pushBoundedQueue(&loop->completions, item))
+    {
+        sched_yield();
+    }
+    if (!atomic_exchange(&loop->wakePending, true))
+    {
+        wakeEventLoop(loop);
+    }
+}
+
+bool sameRequest(const DedupEntry *entry, const Request *request)
+{
+    return entry->operation == request->operation && entry->account == request->account
+        && entry->target == request->target && entry->amount == request->amount;
+}
+
+// A request carrying a client id runs at most once. A retry or hedged copy
+// that arrives while the first is running is parked on its history entry
+// and completed with the first one's reply, so it does not hold a worker;
+// one that arrives later gets the stored reply. An id that has run but
+// whose reply is no longer held, or that is older than the seen bitmap or
+// DEDUP_SECONDS, is answered STATUS_EXPIRED rather than run again, and a
+// request whose slot or history cannot be had gets STATUS_BUSY.
+// Returns false when the item was parked and will be completed later.
+bool executeOnce(WorkItem *item)
+{
+    const Request *request = &item->request;
+    Response *response = &item->response;
+    if (request->clientId == 0)
+    {
+        item->seq = executeRequest(request, response);
+        return true;
+    }
+
+    DedupStripe *stripe = &dedup.stripes[(request->clientId * 0x9E3779B97F4A7C15ull) >> 56];
+    uint64_t now = monotonicNanos();
+    item->seq = 0;
+
+    pthread_mutex_lock(&stripe->mutex);
+    ClientHistory *history = findClientHistory(stripe, request->clientId, now);
+    if (!history)
+    {
+        pthread_mutex_unlock(&stripe->mutex);
+        rejectRequest(request, response, STATUS_BUSY);
+        return true;
+    }
+    history->lastUsed = now;
+    if (!history->seenId)
+    {
+        history->newestId = request->requestId;
+        history->seenId = true;
+    }
+
+    int32_t age = (int32_t)(history->newestId - request->requestId);
+    DedupEntry *entry = &history->entries[request->requestId & (DEDUP_WINDOW - 1)];
+    bool seen = age >= 0 && idSeen(history, request->requestId);
+    bool held = entry->state != DEDUP_EMPTY && entry->requestId == request->requestId;
+    if (age >= DEDUP_SEEN_IDS || (seen && !held))
+    {
+        item->seq = history->evictedSeq;
+        pthread_mutex_unlock(&stripe->mutex);
+        rejectRequest(request, response, STATUS_EXPIRED);
+        return true;
+    }
+
+    if (held)
+    {
+        uint8_t status = STATUS_OK;
+        if (!sameRequest(entry, request))
+        {
+            status = STATUS_ID_REUSED;
+        }
+        else if (entry->state == DEDUP_RUNNING)
+        {
+            item->next = entry->waiters;
+            entry->waiters = item;
+            pthread_mutex_unlock(&stripe->mutex);
+            return false;
+        }
+        else if (entry->finishedAt + DEDUP_SECONDS * 1000000000ull < now)
+        {
+            status = STATUS_EXPIRED;
+        }
+        else
+        {
+            *response = entry->response;
+            item->seq = entry->seq;
+        }
+        pthread_mutex_unlock(&stripe->mutex);
+
+        if (status != STATUS_OK)
+        {
+            rejectRequest(request, response, status);
+        }
+        else
+        {
+            logMessage("[Client %016llx] Request %u answered from history.\n",
+                       (unsigned long long)request->clientId, request->requestId);
+        }
+        return true;
+    }
+
+    // The id has never run. Its slot may hold another id's reply; that id
+    // keeps its seen bit, so a later retry of it is answered as expired. One
+    // still running cannot be evicted.
+    if (entry->state == DEDUP_RUNNING)
+    {
+        pthread_mutex_unlock(&stripe->mutex);
+        rejectRequest(request, response, STATUS_BUSY);
+        return true;
+    }
+    if (age < 0)
+    {
+        advanceNewestId(history, request->requestId);
+    }
+    markIdSeen(history, request->requestId);
+    if (entry->state == DEDUP_DONE && entry->seq > history->evictedSeq)
+    {
+        history->evictedSeq = entry->seq;
+    }
+    entry->requestId = request->requestId;
+    entry->state = DEDUP_RUNNING;
+    entry->operation = request->operation;
+    entry->account = request->account;
+    entry->target = request->target;
+    entry->amount = request->amount;
+    entry->waiters = NULL;
+    history->running++;
+    pthread_mutex_unlock(&stripe->mutex);
+
+    item->seq = executeRequest(request, response);
+
+    pthread_mutex_lock(&stripe->mutex);
+    entry->response = *response;
+    entry->seq = item->seq;
+    entry->finishedAt = monotonicNanos();
+    entry->state = DEDUP_DONE;
+    WorkItem *waiters = entry->waiters;
+    entry->waiters = NULL;
+    history->running--;
+    pthread_mutex_unlock(&stripe->mutex);
+
+    while (waiters)
+    {
+        WorkItem *waiter = waiters;
+        waiters = waiter->next;
+        waiter->response = *response;
+        waiter->seq = item->seq;
+        completeWorkItem(waiter);
+    }
+    return true;
+}
+
+// Workers run the handlers and hand each finished item back to the loop
+// that owns its connection.
+void *runWorker(void *arg)
+{
+    (void)arg;
+
+    while (1)
+    {
+        while (sem_wait(&workerPool.pendingCount) != 0)
+        {
+        }
+
+        WorkItem *item;
+        while (!(item = popBoundedQueue(&workerPool.pending)))
+        {
+            sched_yield();
+        }
+
+        if (executeOnce(item))
+        {
+            completeWorkItem(item);
+        }
+    }
+
+    return NULL;
+}
+
+bool startWorkerPool(const ServerOptions *options)
+{
+    workerPool.items = calloc(options->maxInFlight, sizeof(WorkItem));
+    if (!workerPool.items
+        || !initBoundedQueue(&workerPool.freeItems, options->maxInFlight)
+        || !initBoundedQueue(&workerPool.pending, options->maxInFlight)
+        || sem_init(&workerPool.pendingCount, 0, 0) != 0)
+    {
+        printf("Error: Cannot create worker pool.\n");
+        return false;
+    }
+    for (int index = 0; index < options->maxInFlight; index++)
+    {
+        pushBoundedQueue(&workerPool.freeItems, &workerPool.items[index]);
+    }
+
+    for (int index = 0; index < options->workerCount; index++)
+    {
+        pthread_t worker;
+        if (pthread_create(&worker, NULL, runWorker, NULL) != 0)
+        {
+            printf("Error: Cannot start worker %d.\n", index);
+            return false;
+        }
+        pthread_detach(worker);
+    }
+    return true;
+}
+
+// Hands the request to the worker pool, or answers BUSY straight away when
+// maxInFlight requests are already queued or running.
+int processClientRequest(EventLoop *loop, Connection *connection, const Request *request)
+{
+    logMessage("[Client %d] Request %u: Operation=%d, Account=%d, Amount=%lld\n",
+               connection->clientNumber, request->requestId, request->operation,
+               request->account, (long long)request->amount);
+
+    if (request->operation == EXIT)
+    {
+        logMessage("[Client %d] Client requested exit.\n", connection->clientNumber);
+        return 0;
+    }
+    if (request->operation == STATS)
+    {
+        queueStatsResponse(connection, request);
+        return 1;
+    }
+
+    WorkItem *item = popBoundedQueue(&workerPool.freeItems);
+    if (!item)
+    {
+        Response response;
+        rejectRequest(request, &response, STATUS_BUSY);
+        queueResponse(connection, &response, 0);
+        bumpCounter(&loop->stats[operationSlot(request->operation)].busy, 1);
+        return 1;
+    }
+
+    item->receivedAt = monotonicNanos();
+    item->loop = loop;
+    item->connection = connection;
+    item->request = *request;
+    connection->inFlight++;
+    pushBoundedQueue(&workerPool.pending, item);
+    sem_post(&workerPool.pendingCount);
+    return 1;
+}
+
+// Requests are fixed-size frames, so a length that does not match means
+// the stream is out of step and the connection is dropped.
+void processInput(EventLoop *loop, Connection *connection)
+{
+    size_t start = 0;
+
+    while (!connection->closing && connection->inputLength - start >= FRAME_HEADER_SIZE)
+    {
+        const unsigned char *frame = connection->input + start;
+        if (getUint32(frame) != REQUEST_SIZE - FRAME_HEADER_SIZE)
+        {
+            logMessage("[Client %d] Malformed request frame.\n", connection->clientNumber);
+            connection->closing = true;
+            break;
+        }
+        if (connection->inputLength - start < REQUEST_SIZE)
+        {
+            break;
+        }
+
+        Request request;
+        decodeRequest(frame, &request);
+        if (!processClientRequest(loop, connection, &request))
+        {
+            connection->closing = true;
+        }
+        start += REQUEST_SIZE;
+    }
+
+    memmove(connection->input, connection->input + start, connection->inputLength - start);
+    connection->inputLength -= start;
+}
+
+// Reads until the socket would block, as edge-triggered epoll requires.
+// Returns false once the peer has gone away.
+bool readFromClient(EventLoop *loop, Connection *connection)
+{
+    while (1)
+    {
+        if (connection->inputLength == BUFFER_SIZE)
+        {
+            processInput(loop, connection);
+            if (connection->closing)
+                return false;
+        }
+        size_t space = BUFFER_SIZE - connection->inputLength;
 
-float readBalance(){
-    FILE *file = fopen(ACCOUNT_FILE, "r");
-    if (!file)
+        ssize_t bytesReceived = recv(connection->clientSocket, connection->input + connection->inputLength, space, 0);
+        if (bytesReceived > 0)
+        {
+            connection->inputLength += bytesReceived;
+            continue;
+        }
+        if (bytesReceived < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytesReceived < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            processInput(loop, connection);
+            return true;
+        }
+
+        processInput(loop, connection);
+        return false;
+    }
+}
+
+#ifdef USE_IO_URING
+// A connection whose receive cannot be queued is marked closing.
+void armReceive(EventLoop *loop, Connection *connection)
+{
+    struct io_uring_sqe *sqe = queueSqe(loop->ring, IORING_OP_RECV, connection->clientSocket,
+                                        (uintptr_t)connection | RING_RECV);
+    if (!sqe)
+    {
+        connection->closing = true;
+        return;
+    }
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = RING_RECV_GROUP;
+    connection->ringPending++;
+}
+
+bool queueSend(EventLoop *loop, Connection *connection)
+{
+    struct io_uring_sqe *sqe = queueSqe(loop->ring, IORING_OP_SEND, connection->clientSocket,
+                                        (uintptr_t)connection | RING_SEND);
+    if (!sqe)
+        return false;
+    sqe->addr = (uintptr_t)(connection->sendBuffer + connection->sendOffset);
+    sqe->len = connection->sendLength - connection->sendOffset;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    connection->ringPending++;
+    return true;
+}
+
+// The kernel owns the buffer until the send completes, so the output
+// buffer is handed over whole and swapped for the spare one. Replies
+// queued meanwhile cannot move it and go out with the next send. Returns
+// false if the send could not be queued.
+bool startSend(EventLoop *loop, Connection *connection)
+{
+    if (connection->sendLength > 0 || connection->outputLength == 0)
+        return true;
+
+    unsigned char *spare = connection->sendBuffer;
+    size_t spareCapacity = connection->sendCapacity;
+    connection->sendBuffer = connection->output;
+    connection->sendCapacity = connection->outputCapacity;
+    connection->sendLength = connection->outputLength;
+    connection->sendOffset = 0;
+    connection->output = spare;
+    connection->outputCapacity = spareCapacity;
+    connection->outputLength = connection->outputSent = 0;
+    if (!queueSend(loop, connection))
     {
-        printf("Error: Cannot open account file. Creating new file with balance 10000.00\n");
-        file = fopen(ACCOUNT_FILE, "w");
-        if (file)
+        connection->sendLength = 0;
+        return false;
+    }
+    return true;
+}
+#endif
+
+bool flushToClient(EventLoop *loop, Connection *connection)
+{
+#ifdef USE_IO_URING
+    if (loop->ring)
+        return startSend(loop, connection);
+#else
+    (void)loop;
+#endif
+    while (connection->outputSent < connection->outputLength)
+    {
+        ssize_t bytesSent = send(connection->clientSocket, connection->output + connection->outputSent,
+                                 connection->outputLength - connection->outputSent, MSG_NOSIGNAL);
+        if (bytesSent > 0)
         {
-            fprintf(file, "10000.00");
-            fclose(file);
+            connection->outputSent += bytesSent;
+            continue;
+        }
+        if (bytesSent < 0 && errno == EINTR)
+        {
+            continue;
         }
-        return 10000.00;
+        return bytesSent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
     }
-    float balance = 0.0f;
 
-    if (fscanf(file, "%f", &balance) != 1) {
-        printf("Error: Failed to read balance. Using default value 10000.00\n");
-        balance = 10000.00f;
+    connection->outputLength = connection->outputSent = 0;
+    return true;
+}
+
+void parkConnection(EventLoop *loop, Connection *connection)
+{
+    if (connection->waiting)
+        return;
+
+    connection->waiting = true;
+    connection->waitPrev = NULL;
+    connection->waitNext = loop->waiting;
+    if (loop->waiting)
+    {
+        loop->waiting->waitPrev = connection;
     }
+    loop->waiting = connection;
+}
 
-    fclose(file);
-    return balance;
+void unparkConnection(EventLoop *loop, Connection *connection)
+{
+    if (!connection->waiting)
+        return;
 
+    if (connection->waitPrev)
+    {
+        connection->waitPrev->waitNext = connection->waitNext;
+    }
+    else
+    {
+        loop->waiting = connection->waitNext;
+    }
+    if (connection->waitNext)
+    {
+        connection->waitNext->waitPrev = connection->waitPrev;
+    }
+    connection->waiting = false;
 }
 
-void writeBalance(float balance)
+// A connection with requests still out at the workers is only marked
+// failed; it is freed when the last of them comes back.
+void closeConnection(EventLoop *loop, Connection *connection)
 {
-    FILE *file = fopen(ACCOUNT_FILE, "w");
-    if (!file)
+    unparkConnection(loop, connection);
+    if (connection->inFlight > 0)
     {
-        printf("Error: Cannot write to account file.\n");
+        connection->closing = true;
+        connection->failed = true;
         return;
     }
-    fprintf(file, "%.2f", balance);
-    fclose(file);
+
+#ifdef USE_IO_URING
+    // Ring operations still point at the connection. A send in progress is
+    // let finish unless the connection failed; otherwise shutting the
+    // socket down makes the kernel complete them, and the last completion
+    // comes back here.
+    if (connection->ringPending > 0)
+    {
+        connection->closing = true;
+        if (connection->sendLength > 0 && !connection->failed)
+            return;
+        connection->failed = true;
+        if (!connection->shutDown)
+        {
+            shutdown(connection->clientSocket, SHUT_RDWR);
+            connection->shutDown = true;
+        }
+        return;
+    }
+#endif
+    if (connection->closed)
+        return;
+
+    // Later events in the same epoll batch may still point here, so the
+    // memory is only released once the batch is done.
+    logMessage("[Client %d] Client disconnected.\n", connection->clientNumber);
+    close(connection->clientSocket);
+    connection->closed = true;
+    connection->waitNext = loop->closed;
+    loop->closed = connection;
 }
 
-void handleWithdraw(int clientSocket, float amount)
+void releaseClosedConnections(EventLoop *loop)
 {
-    char response[BUFFER_SIZE];
+    while (loop->closed)
+    {
+        Connection *connection = loop->closed;
+        loop->closed = connection->waitNext;
+        free(connection->output);
+        free(connection->held);
+#ifdef USE_IO_URING
+        free(connection->sendBuffer);
+#endif
+        free(connection);
+    }
+}
 
-    pthread_mutex_lock(&fileMutex);
+// Remembers a finished request until its reply is released. If there is no
+// room to hold it, it is recorded now instead.
+void holdReply(EventLoop *loop, Connection *connection, const WorkItem *item)
+{
+    HeldReply reply = {item->request.operation, item->response.status, item->receivedAt};
+    if (connection->heldCount == connection->heldCapacity)
+    {
+        size_t capacity = connection->heldCapacity ? connection->heldCapacity * 2 : 16;
+        HeldReply *grown = realloc(connection->held, capacity * sizeof(HeldReply));
+        if (!grown)
+        {
+            recordCompletion(loop, &reply, monotonicNanos());
+            return;
+        }
+        connection->held = grown;
+        connection->heldCapacity = capacity;
+    }
+    connection->held[connection->heldCount++] = reply;
+}
 
-    float currentBalance = readBalance();
+void releaseHeldReplies(EventLoop *loop, Connection *connection)
+{
+    if (connection->heldCount == 0)
+        return;
 
-    if (amount > currentBalance)
+    uint64_t now = monotonicNanos();
+    for (size_t index = 0; index < connection->heldCount; index++)
     {
-        snprintf(response, BUFFER_SIZE,
-                 "FAILED: Insufficient balance. Current balance: %.2f",
-                 currentBalance);
+        recordCompletion(loop, &connection->held[index], now);
     }
-    else if (amount <= 0)
+    connection->heldCount = 0;
+}
+
+// Sends the replies whose ledger records are durable. Connections still
+// waiting on the log are parked until the committer wakes the loop, and a
+// closing connection is only dropped once its replies are out.
+void serviceConnection(EventLoop *loop, Connection *connection)
+{
+    if (connection->failed)
     {
-        snprintf(response, BUFFER_SIZE, "FAILED: Invalid amount.");
+        releaseHeldReplies(loop, connection);
+        closeConnection(loop, connection);
+        return;
     }
-    else
+    if (connection->waitSeq > atomic_load(&ledger.durableSeq))
     {
-        float newBalance = currentBalance - amount;
-        writeBalance(newBalance);
-        snprintf(response, BUFFER_SIZE,
-                 "SUCCESS: Withdrawn %.2f. New balance: %.2f",
-                 amount, newBalance);
+        parkConnection(loop, connection);
+        return;
     }
+    unparkConnection(loop, connection);
+    releaseHeldReplies(loop, connection);
 
-    pthread_mutex_unlock(&fileMutex);
+    if (!flushToClient(loop, connection))
+    {
+        closeConnection(loop, connection);
+        return;
+    }
+    if (connection->closing && connection->outputLength == 0 && connection->inFlight == 0)
+    {
+        closeConnection(loop, connection);
+    }
+}
 
-    send(clientSocket, response, strlen(response), 0);
+void drainWakeups(EventLoop *loop)
+{
+    unsigned long long wakeups;
+    if (read(loop->wakeFd, &wakeups, sizeof(wakeups)) < 0 && errno != EAGAIN)
+    {
+        logMessage("Error: Cannot read wakeup for event loop %d.\n", loop->loopNumber);
+    }
 }
 
-void handleDeposit(int clientSocket, float amount)
+// Woken by workers with finished requests and by the committer when more
+// of the log is durable.
+void serviceWaitingConnections(EventLoop *loop)
 {
-    char response[BUFFER_SIZE];
+    atomic_store(&loop->wakePending, false);
+
+    WorkItem *item;
+    while ((item = popBoundedQueue(&loop->completions)))
+    {
+        Connection *connection = item->connection;
+        holdReply(loop, connection, item);
+        if (!connection->failed)
+        {
+            queueResponse(connection, &item->response, item->seq);
+        }
+        connection->inFlight--;
+        pushBoundedQueue(&workerPool.freeItems, item);
+        serviceConnection(loop, connection);
+    }
 
-    pthread_mutex_lock(&fileMutex);
+    Connection *connection = loop->waiting;
+    while (connection)
+    {
+        Connection *next = connection->waitNext;
+        serviceConnection(loop, connection);
+        connection = next;
+    }
+}
 
-    if (amount <= 0)
+Connection *newConnection(int clientSocket)
+{
+    Connection *connection = calloc(1, sizeof(Connection));
+    if (!connection)
     {
-        snprintf(response, BUFFER_SIZE, "FAILED: Invalid amount.");
+        logMessage("Error: Out of memory for new client.\n");
+        close(clientSocket);
+        return NULL;
     }
-    else
+    connection->clientSocket = clientSocket;
+    connection->clientNumber = atomic_fetch_add(&clientCounter, 1) + 1;
+    return connection;
+}
+
+void acceptClientConnections(EventLoop *loop)
+{
+    while (1)
     {
-        float currentBalance = readBalance();
-        float newBalance = currentBalance + amount;
-        writeBalance(newBalance);
-        snprintf(response, BUFFER_SIZE,
-                 "SUCCESS: Deposited %.2f. New balance: %.2f",
-                 amount, newBalance);
+        struct sockaddr_in clientAddr;
+        socklen_t addrSize = sizeof(clientAddr);
+        int clientSocket = accept4(loop->serverSocket, (struct sockaddr *)&clientAddr, &addrSize, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (clientSocket < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                logMessage("Error: Accept failed.\n");
+            }
+            return;
+        }
+
+        Connection *connection = newConnection(clientSocket);
+        if (!connection)
+            continue;
+
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = connection;
+        if (epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, clientSocket, &event) < 0)
+        {
+            logMessage("Error: Cannot watch client socket.\n");
+            close(clientSocket);
+            free(connection);
+            continue;
+        }
+
+        logMessage("[Loop %d] Client %d connected.\n", loop->loopNumber, connection->clientNumber);
     }
+}
+
+void handleConnectionEvent(EventLoop *loop, Connection *connection, uint32_t events)
+{
+    if (connection->closed)
+        return;
 
-    pthread_mutex_unlock(&fileMutex);
+    if (events & EPOLLERR)
+    {
+        closeConnection(loop, connection);
+        return;
+    }
 
-    send(clientSocket, response, strlen(response), 0);
+    if (!connection->closing && (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) && !readFromClient(loop, connection))
+    {
+        connection->closing = true;
+    }
+    serviceConnection(loop, connection);
 }
 
-void handleBalance(int clientSocket)
+// Each loop owns an epoll set and only ever touches its own connections,
+// so connections need no locking. The listening socket is either private
+// to the loop (SO_REUSEPORT) or shared with EPOLLEXCLUSIVE wakeups.
+void *runEventLoop(void *arg)
 {
-    char response[BUFFER_SIZE];
+    EventLoop *loop = (EventLoop *)arg;
+    struct epoll_event events[MAX_EVENTS];
 
-    pthread_mutex_lock(&fileMutex);
+    while (1)
+    {
+        int ready = epoll_wait(loop->epollFd, events, MAX_EVENTS, -1);
+        if (ready < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            logMessage("Error: epoll_wait failed.\n");
+            break;
+        }
 
-    float currentBalance = readBalance();
-    snprintf(response, BUFFER_SIZE, "Current balance: %.2f", currentBalance);
+        for (int index = 0; index < ready; index++)
+        {
+            if (events[index].data.ptr == NULL)
+            {
+                acceptClientConnections(loop);
+            }
+            else if (events[index].data.ptr == loop)
+            {
+                drainWakeups(loop);
+                serviceWaitingConnections(loop);
+            }
+            else
+            {
+                handleConnectionEvent(loop, (Connection *)events[index].data.ptr, events[index].events);
+            }
+        }
+        releaseClosedConnections(loop);
+    }
 
-    pthread_mutex_unlock(&fileMutex);
+    return NULL;
+}
 
-    send(clientSocket, response, strlen(response), 0);
+#ifdef USE_IO_URING
+bool armAccept(EventLoop *loop)
+{
+    struct io_uring_sqe *sqe = queueSqe(loop->ring, IORING_OP_ACCEPT, loop->serverSocket, (uintptr_t)loop | RING_ACCEPT);
+    if (!sqe)
+        return false;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    return true;
 }
 
-int processClientRequest(int clientSocket, int clientNumber, char *buffer)
+bool armWakeup(EventLoop *loop)
 {
-    int operation;
-    float amount;
+    struct io_uring_sqe *sqe = queueSqe(loop->ring, IORING_OP_READ, loop->wakeFd, (uintptr_t)loop | RING_WAKE);
+    if (!sqe)
+        return false;
+    sqe->addr = (uintptr_t)&loop->ring->wakeValue;
+    sqe->len = sizeof(loop->ring->wakeValue);
+    return true;
+}
 
-    sscanf(buffer, "%d %f", &operation, &amount);
+void recycleReceiveBuffer(Ring *ring, unsigned short bufferId)
+{
+    struct io_uring_buf *buffer = &ring->recvRing->bufs[ring->recvTail & (RING_RECV_BUFFERS - 1)];
+    buffer->addr = (uintptr_t)(ring->recvBuffers + (size_t)bufferId * BUFFER_SIZE);
+    buffer->len = BUFFER_SIZE;
+    buffer->bid = bufferId;
+    ring->recvTail++;
+    atomic_store_explicit((_Atomic unsigned short *)&ring->recvRing->tail, ring->recvTail, memory_order_release);
+}
 
-    printf("[Thread %d] Request: Operation=%d, Amount=%.2f\n",
-           clientNumber, operation, amount);
+bool setupRingLoop(EventLoop *loop)
+{
+    Ring *ring = createRing(RING_ENTRIES);
+    if (!ring)
+        return false;
 
-    if (operation == WITHDRAW)
+    ring->recvRing = mmap(NULL, RING_RECV_BUFFERS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ring->recvBuffers = malloc((size_t)RING_RECV_BUFFERS * BUFFER_SIZE);
+    if (ring->recvRing == MAP_FAILED || !ring->recvBuffers)
     {
-        handleWithdraw(clientSocket, amount);
+        destroyRing(ring);
+        return false;
     }
-    else if (operation == DEPOSIT)
+
+    struct io_uring_buf_reg registration;
+    memset(&registration, 0, sizeof(registration));
+    registration.ring_addr = (uintptr_t)ring->recvRing;
+    registration.ring_entries = RING_RECV_BUFFERS;
+    registration.bgid = RING_RECV_GROUP;
+    if (syscall(__NR_io_uring_register, ring->ringFd, IORING_REGISTER_PBUF_RING, &registration, 1) < 0)
     {
-        handleDeposit(clientSocket, amount);
+        destroyRing(ring);
+        return false;
     }
-    else if (operation == BALANCE)
+
+    for (int bufferId = 0; bufferId < RING_RECV_BUFFERS; bufferId++)
     {
-        handleBalance(clientSocket);
+        recycleReceiveBuffer(ring, bufferId);
     }
-    else if (operation == EXIT)
+    loop->ring = ring;
+    return true;
+}
+
+void handleRingAccept(EventLoop *loop, int result, unsigned flags)
+{
+    if (!(flags & IORING_CQE_F_MORE) && !armAccept(loop))
     {
-        printf("[Thread %d] Client requested exit.\n", clientNumber);
-        return 0;
+        fprintf(stderr, "Error: Cannot re-arm accept on event loop %d.\n", loop->loopNumber);
     }
-    else
+    if (result < 0)
     {
-        send(clientSocket, "Invalid operation.", 18, 0);
+        if (result != -EINTR && result != -ECONNABORTED && result != -EAGAIN)
+        {
+            logMessage("Error: Accept failed.\n");
+        }
+        return;
     }
 
-    return 1;
+    Connection *connection = newConnection(result);
+    if (!connection)
+        return;
+    armReceive(loop, connection);
+    if (connection->closing)
+    {
+        closeConnection(loop, connection);
+        return;
+    }
+    logMessage("[Loop %d] Client %d connected.\n", loop->loopNumber, connection->clientNumber);
 }
 
-void *handleClient(void *arg)
+// Received data is copied out of the kernel's buffer at once so the buffer
+// can go straight back to the ring.
+void handleRingReceive(EventLoop *loop, Connection *connection, int result, unsigned flags)
 {
-    ClientInfo *clientInfo = (ClientInfo *)arg;
-    int clientSocket = clientInfo->clientSocket;
-    int clientNumber = clientInfo->clientNumber;
+    if (!(flags & IORING_CQE_F_MORE))
+    {
+        connection->ringPending--;
+    }
 
-    printf("[Thread %d] Client connected.\n", clientNumber);
+    if (result > 0)
+    {
+        unsigned short bufferId = flags >> IORING_CQE_BUFFER_SHIFT;
+        const unsigned char *data = loop->ring->recvBuffers + (size_t)bufferId * BUFFER_SIZE;
+        size_t length = result;
+        while (length > 0 && !connection->closing)
+        {
+            size_t chunk = BUFFER_SIZE - connection->inputLength;
+            chunk = chunk < length ? chunk : length;
+            memcpy(connection->input + connection->inputLength, data, chunk);
+            connection->inputLength += chunk;
+            data += chunk;
+            length -= chunk;
+            processInput(loop, connection);
+        }
+        recycleReceiveBuffer(loop->ring, bufferId);
+    }
+    else if (result != -ENOBUFS)
+    {
+        connection->closing = true;
+    }
 
-    char buffer[BUFFER_SIZE];
+    if (!(flags & IORING_CQE_F_MORE) && !connection->closing)
+    {
+        armReceive(loop, connection);
+    }
+    serviceConnection(loop, connection);
+}
 
-    while (1)
+void handleRingSend(EventLoop *loop, Connection *connection, int result)
+{
+    connection->ringPending--;
+    if (result <= 0)
     {
-        memset(buffer, 0, BUFFER_SIZE);
+        connection->failed = true;
+    }
+    else
+    {
+        connection->sendOffset += result;
+        if (connection->sendOffset < connection->sendLength && !connection->failed)
+        {
+            if (queueSend(loop, connection))
+                return;
+            connection->failed = true;
+        }
+    }
+    connection->sendLength = 0;
+    serviceConnection(loop, connection);
+}
+
+// The io_uring counterpart of runEventLoop. Accepts and receives are
+// multishot, so they stay armed across completions, and everything queued
+// while handling one batch of completions is submitted by the same
+// io_uring_enter that waits for the next.
+void *runRingLoop(void *arg)
+{
+    EventLoop *loop = (EventLoop *)arg;
+    Ring *ring = loop->ring;
 
-        int bytesReceived = recv(clientSocket, buffer, BUFFER_SIZE, 0);
+    if (!armAccept(loop) || !armWakeup(loop))
+    {
+        fprintf(stderr, "Error: Cannot arm event loop %d.\n", loop->loopNumber);
+        return NULL;
+    }
 
-        if (bytesReceived <= 0)
+    while (1)
+    {
+        if (enterRing(ring, 1) < 0 && errno != EINTR && errno != EBUSY)
         {
-            printf("[Thread %d] Client disconnected.\n", clientNumber);
+            fprintf(stderr, "Error: io_uring_enter failed on event loop %d: %s.\n", loop->loopNumber, strerror(errno));
             break;
         }
 
-        if (!processClientRequest(clientSocket, clientNumber, buffer))
+        unsigned head = atomic_load_explicit(ring->cqHead, memory_order_relaxed);
+        while (head != atomic_load_explicit(ring->cqTail, memory_order_acquire))
         {
-            break;
+            struct io_uring_cqe *cqe = &ring->cqes[head & ring->cqMask];
+            uint64_t userData = cqe->user_data;
+            int result = cqe->res;
+            unsigned flags = cqe->flags;
+            atomic_store_explicit(ring->cqHead, ++head, memory_order_release);
+
+            void *target = (void *)(uintptr_t)(userData & ~(uint64_t)RING_KIND_MASK);
+            switch (userData & RING_KIND_MASK)
+            {
+            case RING_ACCEPT:
+                handleRingAccept(loop, result, flags);
+                break;
+            case RING_WAKE:
+                if (result < 0)
+                {
+                    logMessage("Error: Cannot read wakeup for event loop %d.\n", loop->loopNumber);
+                }
+                if (!armWakeup(loop))
+                {
+                    fprintf(stderr, "Error: Cannot re-arm wakeup on event loop %d.\n", loop->loopNumber);
+                }
+                serviceWaitingConnections(loop);
+                break;
+            case RING_RECV:
+                handleRingReceive(loop, (Connection *)target, result, flags);
+                break;
+            case RING_SEND:
+                handleRingSend(loop, (Connection *)target, result);
+                break;
+            }
         }
+        releaseClosedConnections(loop);
+    }
+
+    return NULL;
+}
+#endif
+
+// Gives the loop its io_uring or epoll set and starts its thread. A kernel
+// without the ring features the loop needs gets the epoll loop instead.
+bool startEventLoop(EventLoop *loop, const ServerOptions *options, pthread_t *thread)
+{
+#ifdef USE_IO_URING
+    if (options->ioUring)
+    {
+        if (setupRingLoop(loop))
+            return pthread_create(thread, NULL, runRingLoop, loop) == 0;
+        printf("Event loop %d: io_uring unavailable, using epoll.\n", loop->loopNumber);
+        if (fcntl(loop->wakeFd, F_SETFL, fcntl(loop->wakeFd, F_GETFL) | O_NONBLOCK) < 0)
+            return false;
     }
+#endif
+    loop->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epollFd < 0)
+        return false;
 
-    close(clientSocket);
-    free(clientInfo);
-    pthread_exit(NULL);
+    struct epoll_event event;
+    event.events = options->reusePort ? EPOLLIN : (EPOLLIN | EPOLLEXCLUSIVE);
+    event.data.ptr = NULL;
+    struct epoll_event wakeEvent;
+    wakeEvent.events = EPOLLIN;
+    wakeEvent.data.ptr = loop;
+    return epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, loop->serverSocket, &event) == 0
+        && epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, loop->wakeFd, &wakeEvent) == 0
+        && pthread_create(thread, NULL, runEventLoop, loop) == 0;
 }
 
-int createServerSocket()
+int createServerSocket(bool reusePort)
 {
-    int serverSocket = socket(AF_INET, SOCK_STREAM, 0);
+    int serverSocket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (serverSocket < 0)
     {
         printf("Error: Socket creation failed.\n");
@@ -209,6 +2879,12 @@ int createServerSocket()
 
     int opt = 1;
     setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (reusePort && setsockopt(serverSocket, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)
+    {
+        printf("Error: SO_REUSEPORT not supported.\n");
+        close(serverSocket);
+        return -1;
+    }
 
     return serverSocket;
 }
@@ -232,84 +2908,178 @@ int bindServerSocket(int serverSocket)
 
 int startListening(int serverSocket)
 {
-    if (listen(serverSocket, 5) < 0)
+    if (listen(serverSocket, SOMAXCONN) < 0)
     {
         printf("Error: Listen failed.\n");
         return 0;
     }
 
-    printf("Server started on port %d\n", PORT);
-    printf("Waiting for clients...\n\n");
-
     return 1;
 }
 
-void acceptClientConnections(int serverSocket)
+int openListeningSocket(bool reusePort)
 {
-    struct sockaddr_in clientAddr;
-    socklen_t addrSize;
-    int clientCounter = 0;
+    int serverSocket = createServerSocket(reusePort);
+    if (serverSocket == -1)
+        return -1;
 
-    while (1)
+    if (!bindServerSocket(serverSocket) || !startListening(serverSocket))
     {
-        addrSize = sizeof(clientAddr);
-        int clientSocket = accept(serverSocket, (struct sockaddr *)&clientAddr, &addrSize);
-
-        if (clientSocket < 0)
-        {
-            printf("Error: Accept failed.\n");
-            continue;
-        }
+        close(serverSocket);
+        return -1;
+    }
 
-        clientCounter++;
+    return serverSocket;
+}
 
-        pthread_t thread;
-        ClientInfo *clientInfo = (ClientInfo *)malloc(sizeof(ClientInfo));
-        clientInfo->clientSocket = clientSocket;
-        clientInfo->clientNumber = clientCounter;
+bool parseServerOptions(int argc, char *argv[], ServerOptions *options)
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    options->loopCount = (cores > 0 && cores < MAX_EVENT_LOOPS) ? (int)cores : 1;
+    options->reusePort = false;
+    options->workerCount = (cores > 0 && cores < MAX_WORKERS) ? (int)cores : 1;
+    options->maxInFlight = DEFAULT_MAX_IN_FLIGHT;
+    options->dedupClients = DEDUP_CLIENTS;
+    options->ioUring = false;
+    options->dataDir = DEFAULT_DATA_DIR;
 
-        if (pthread_create(&thread, NULL, handleClient, (void *)clientInfo) != 0)
+    for (int index = 1; index < argc; index++)
+    {
+        if (strcmp(argv[index], "--reuseport") == 0)
         {
-            printf("Error: Thread creation failed.\n");
-            close(clientSocket);
-            free(clientInfo);
+            options->reusePort = true;
+        }
+        else if (strcmp(argv[index], "--loops") == 0 && index + 1 < argc)
+        {
+            options->loopCount = atoi(argv[++index]);
+        }
+        else if (strcmp(argv[index], "--workers") == 0 && index + 1 < argc)
+        {
+            options->workerCount = atoi(argv[++index]);
+        }
+        else if (strcmp(argv[index], "--max-inflight") == 0 && index + 1 < argc)
+        {
+            options->maxInFlight = atoi(argv[++index]);
+        }
+        else if (strcmp(argv[index], "--dedup-clients") == 0 && index + 1 < argc)
+        {
+            options->dedupClients = atoi(argv[++index]);
+        }
+        else if (strcmp(argv[index], "--data-dir") == 0 && index + 1 < argc)
+        {
+            options->dataDir = argv[++index];
         }
+#ifdef USE_IO_URING
+        else if (strcmp(argv[index], "--io-uring") == 0)
+        {
+            options->ioUring = true;
+        }
+#endif
         else
         {
-            pthread_detach(thread);
+            return false;
         }
     }
+
+    return options->loopCount >= 1 && options->loopCount <= MAX_EVENT_LOOPS
+        && options->workerCount >= 1 && options->workerCount <= MAX_WORKERS
+        && options->maxInFlight >= 1 && options->dedupClients >= 1 && options->dataDir[0] != '\0';
 }
 
-void initiateServer()
+// Returns false when the server could not start, so main exits non-zero.
+bool initiateServer(const ServerOptions *options)
 {
     printf("\n============================================\n");
     printf("ATM Server - Socket IPC Mechanism");
     printf("\n============================================\n");
 
-    int serverSocket = createServerSocket();
-    if (serverSocket == -1)
-        return;
+    pthread_t threads[MAX_EVENT_LOOPS];
+    pthread_t committer;
+    int sharedSocket = -1;
 
-    if (!bindServerSocket(serverSocket))
+    if (!startLogger())
     {
-        close(serverSocket);
-        return;
+        printf("Error: Cannot start logger.\n");
+        return false;
+    }
+    initDedupTable(options->dedupClients);
+    if (!prepareDataDirectory(options->dataDir) || !openLedger() || !startWorkerPool(options))
+        return false;
+#ifdef USE_IO_URING
+    if (options->ioUring && !(ledger.ring = createRing(4)))
+    {
+        printf("Ledger log: io_uring unavailable, using write and fdatasync.\n");
     }
+#endif
 
-    if (!startListening(serverSocket))
+    if (!options->reusePort)
     {
-        close(serverSocket);
-        return;
+        sharedSocket = openListeningSocket(false);
+        if (sharedSocket == -1)
+            return false;
+    }
+
+    int started = 0;
+    for (int index = 0; index < options->loopCount; index++)
+    {
+        EventLoop *loop = &eventLoops[index];
+        loop->loopNumber = index;
+        loop->waiting = NULL;
+        loop->closed = NULL;
+        loop->serverSocket = options->reusePort ? openListeningSocket(true) : sharedSocket;
+        loop->wakeFd = eventfd(0, (options->ioUring ? 0 : EFD_NONBLOCK) | EFD_CLOEXEC);
+        atomic_init(&loop->wakePending, false);
+        loop->stats = calloc(OPERATION_SLOTS, sizeof(OperationStats));
+        if (loop->serverSocket == -1 || loop->wakeFd < 0 || !loop->stats
+            || !initBoundedQueue(&loop->completions, options->maxInFlight)
+            || !startEventLoop(loop, options, &threads[index]))
+        {
+            printf("Error: Cannot start event loop %d.\n", index);
+            break;
+        }
+        started++;
+    }
+    eventLoopCount = started;
+
+    if (started > 0 && pthread_create(&committer, NULL, runLedgerCommitter, NULL) != 0)
+    {
+        printf("Error: Cannot start ledger committer.\n");
+        return false;
     }
 
-    acceptClientConnections(serverSocket);
+    bool onRing = false;
+#ifdef USE_IO_URING
+    onRing = started > 0 && eventLoops[0].ring != NULL;
+#endif
+    if (started > 0)
+    {
+        printf("Server started on port %d with %d event loop(s)%s%s, %d worker(s), %d request(s) in flight\n",
+               PORT, started, options->reusePort ? " using SO_REUSEPORT" : "",
+               onRing ? " on io_uring" : "", options->workerCount, options->maxInFlight);
+        printf("Waiting for clients...\n\n");
+    }
+
+    for (int index = 0; index < started; index++)
+    {
+        pthread_join(threads[index], NULL);
+    }
 
-    close(serverSocket);
+    if (sharedSocket != -1)
+    {
+        close(sharedSocket);
+    }
+    return started > 0;
 }
 
-int main()
+int main(int argc, char *argv[])
 {
-    initiateServer();
-    return 0;
-}
\ No newline at end of file
+    ServerOptions options;
+    if (!parseServerOptions(argc, argv, &options))
+    {
+        printf("Usage: %s [--loops N] [--reuseport] [--workers N] [--max-inflight N] [--dedup-clients N] [--data-dir DIR]%s\n", argv[0], IO_URING_USAGE);
+        return 1;
+    }
+
+    setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+    return initiateServer(&options) ? 0 : 1;
+}